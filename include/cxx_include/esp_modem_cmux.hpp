@@ -14,11 +14,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <vector>
 #include "esp_modem_terminal.hpp"
+#include "esp_modem_config.h"
 
 namespace esp_modem {
 
-constexpr size_t MAX_TERMINALS_NUM = 2;
+constexpr size_t MAX_TERMINALS_NUM = 63;
 /**
  * @defgroup ESP_MODEM_CMUX ESP_MODEM CMUX class
  * @brief Definition of CMUX terminal
@@ -38,6 +41,29 @@ enum class cmux_state {
     RECOVER,
 };
 
+/**
+ * @brief Transmit statistics of a CMUX virtual terminal
+ */
+struct cmux_tx_stats {
+    size_t requests;            /*!< Number of write requests */
+    uint64_t total_delay_us;    /*!< Accumulated delay between queueing the requests and sending their first frame */
+    uint32_t max_delay_us;      /*!< Worst-case queueing delay */
+};
+
+constexpr size_t CMUX_RTT_HISTOGRAM_SIZE = 12;
+
+/**
+ * @brief Keep-alive statistics of the CMUX link
+ */
+struct cmux_keepalive_stats {
+    uint32_t sent;              /*!< Number of sent test messages */
+    uint32_t received;          /*!< Number of matching responses */
+    uint32_t lost;              /*!< Number of responses not received in time */
+    uint32_t last_rtt_us;       /*!< Round trip time of the last response */
+    uint32_t max_rtt_us;        /*!< Worst-case round trip time */
+    uint32_t rtt_histogram[CMUX_RTT_HISTOGRAM_SIZE]; /*!< Bucket i counts round trip times below 2^i ms, the last one all above */
+};
+
 /**
  * @brief CMUX terminal abstraction
  *
@@ -54,38 +80,194 @@ class CMuxInstance;
  */
 class CMux {
 public:
-    explicit CMux(std::unique_ptr<Terminal> t, std::unique_ptr<uint8_t[]> b, size_t buff_size):
-        term(std::move(t)), payload_start(nullptr), total_payload_size(0), buffer_size(buff_size), buffer(std::move(b))  {}
-    ~CMux() = default;
+    explicit CMux(std::unique_ptr<Terminal> t, std::unique_ptr<uint8_t[]> b, size_t buff_size,
+                  const esp_modem_cmux_config *config = nullptr);
+    ~CMux();
 
     /**
-     * @brief Initializes CMux protocol
+     * @brief Initializes CMux protocol (opens the control channel and the first two virtual terminals)
      * @return true on success
      */
     [[nodiscard]] bool init();
 
+    /**
+     * @brief Opens the virtual terminal (establishes its DLC)
+     * @param inst Index of the terminal (DLCI - 1)
+     * @return true on success
+     */
+    bool open_terminal(int inst);
+
+    /**
+     * @brief Closes the virtual terminal (disconnects its DLC)
+     *
+     * The read callback is removed and the received data, retained or arriving later, are dropped
+     * @param inst Index of the terminal (DLCI - 1)
+     * @return true if the modem acknowledged the disconnection
+     */
+    bool close_terminal(int inst);
+
+    /**
+     * @brief Sets how long to wait for the modem to acknowledge opening/closing of the virtual terminal
+     * @param inst Index of the terminal
+     * @param timeout_ms Timeout of one attempt
+     * @param retries Number of retransmissions of SABM/DISC if not acknowledged in time
+     */
+    void set_connect_policy(int inst, uint32_t timeout_ms, uint32_t retries);
+
+    /**
+     * @brief Number of virtual terminals this CMux could open
+     */
+    size_t terminals_num() const
+    {
+        return dlcis.size();
+    }
+
     /**
      * @brief Sets read callback for the appropriate terminal
+     *
+     * @note The data retained in the receive ring are posted to the new callback right away.
+     * Removing the callback (nullptr) discards the retained and further received data, until read() is used again.
      * @param inst Index of the terminal
      * @param f function pointer
      */
     void set_read_cb(int inst, std::function<bool(uint8_t *data, size_t len)> f);
 
+    /**
+     * @brief Reads the received data of the appropriate terminal, which were not consumed by its read callback
+     *
+     * @note Data are retained in the terminal's receive ring only if no read callback is set,
+     * and the callback hasn't been removed since the last read
+     * @param inst Index of the terminal
+     * @param data Buffer to read to
+     * @param len Size of the buffer
+     * @return The actual read length
+     */
+    int read(int inst, uint8_t *data, size_t len);
+
     /**
      * @brief Writes to the appropriate terminal
+     *
+     * @note Frames of concurrent writers are interleaved according to priorities of their terminals
+     * @note Blocks while the modem keeps the flow of the terminal stopped
      * @param i Index of the terminal
      * @param data Data to write
      * @param len Data length to write
-     * @return The actual written length
+     * @return The actual written length, 0 if the terminal isn't open, -1 if given up while stopped by flow control
+     * (the terminal got closed, the link went down or the CMux is being destroyed)
      */
     int write(int i, uint8_t *data, size_t len);
 
+    /**
+     * @brief Checks whether the modem stopped accepting data of the appropriate terminal (MSC/FCOFF flow control)
+     *
+     * @note Writes to a stopped terminal block until the modem resumes the flow
+     * @param inst Index of the terminal
+     */
+    bool tx_stopped(int inst);
+
+    /**
+     * @brief Number of bytes accepted by the original terminal but not yet sent out (shared by all terminals)
+     */
+    size_t queued_bytes()
+    {
+        return term->queued_bytes();
+    }
+
+    /**
+     * @brief Sets transmit priority of the appropriate terminal
+     * @param inst Index of the terminal
+     * @param priority Priority (0 is the highest), command terminal uses 1, others 7 by default
+     */
+    void set_priority(int inst, uint8_t priority);
+
+    /**
+     * @brief Transmit (queueing delay) statistics of the appropriate terminal
+     * @param inst Index of the terminal
+     */
+    cmux_tx_stats tx_stats(int inst);
+
+    /**
+     * @brief Number of received frames dropped due to FCS mismatch
+     */
+    size_t fcs_error_count() const
+    {
+        return fcs_errors;
+    }
+
+    /**
+     * @brief Sets callback to be notified when the keep-alive misses the configured number of responses in a row
+     *
+     * @note Called from the keep-alive task
+     */
+    void set_link_down_cb(std::function<void()> f);
+
+    /**
+     * @brief Keep-alive (link round trip time) statistics
+     */
+    cmux_keepalive_stats keepalive_stats();
+
+    /**
+     * @brief Number of received frames dropped since they didn't fit the receive ring of their terminal
+     */
+    size_t rx_overflow_count() const
+    {
+        return rx_overflows;
+    }
+
+    /**
+     * @brief Maximum frame size (N1) used when writing to the appropriate terminal
+     * @param inst Index of the terminal
+     */
+    size_t frame_size(int inst) const
+    {
+        if (inst < 0 || inst >= static_cast<int>(dlcis.size())) {
+            return 0;
+        }
+        return dlcis[inst].frame_size;
+    }
+
 private:
-    static uint8_t fcs_crc(const uint8_t frame[6]);     /*!< Utility to calculate FCS CRC */
     void data_available(uint8_t *data, size_t len);     /*!< Called when valid data available */
-    void send_sabm(size_t i);                           /*!< Sending initial SABM */
+    void deliver(size_t inst);                          /*!< Posts received data of the terminal to its read callback */
+    void update_rx_flow(size_t inst);                   /*!< Signals flow off/on to the modem if the receive ring fills up/drains */
+    void drop_frame();                                  /*!< Discards payload of the currently received frame */
+    void send_frame(size_t i, uint8_t frame_type);      /*!< Sending a command frame without payload (SABM, DISC) */
+    bool connect(const size_t *list, size_t count, uint8_t frame_type); /*!< Sends the command frames of all listed DLCIs and waits for UA */
+    int wait_for_ack(size_t i, std::chrono::steady_clock::time_point deadline); /*!< Waits for UA (1) or DM (-1) of the DLCI, 0 on timeout */
+    void prepare_terminal(size_t inst);                 /*!< Resets DLC parameters before opening the terminal */
+    bool negotiate(size_t i);                           /*!< Negotiates DLC parameters (frame size) with PN command */
+    void send_pn(size_t i, uint8_t cr, size_t n1);      /*!< Sending DLC parameter negotiation message */
+    void send_control(const uint8_t *msg, size_t len);  /*!< Sending control channel message on DLCI 0 (lock to be held if data could be sent concurrently) */
+    void send_msc(size_t i, bool flow_off);             /*!< Sending modem status (flow control) of the DLCI */
+    void respond(const uint8_t *msg, size_t len);       /*!< Sending response to the control channel command */
+    void on_control(const uint8_t *msg, size_t len);    /*!< Called when a control channel message received */
+    void keepalive();                                   /*!< Keep-alive task: periodically sends test messages and checks responses */
+    bool send_test(uint32_t seq);                       /*!< Sends test message and waits for its response, false on timeout */
+
+    struct TxRequest;                                   /*!< Forward declare pending write request, used by the TX scheduler */
+    /**
+     * Queue of pending write requests
+     */
+    struct TxQueue {
+        TxRequest *head{nullptr};
+        TxRequest *tail{nullptr};
+    };
+    int transmit(size_t i, uint8_t *data, size_t len, bool raw);    /*!< Queues the data and sends pending frames until sent, returns the length, 0 or -1 as write() */
+    bool send_pending(TxRequest &req);                              /*!< Sends pending frames, false if stopped by flow control before sending the request */
+    bool give_up(size_t i, TxRequest &req);                         /*!< Dequeues the request stopped by flow control if it can't be sent anymore */
+    TxRequest *schedule(size_t &i);                                 /*!< Picks the request of highest priority DLC */
+    void send_frames(TxRequest *req, size_t i, size_t frame_size, size_t quantum); /*!< Sends frames of the request */
     bool on_cmux(uint8_t *data, size_t len);            /*!< Called from terminal layer when raw CMUX protocol data available */
 
+    /**
+     * Advanced option framing
+     */
+    void send_frames_advanced(TxRequest *req, size_t i, size_t frame_size, size_t quantum); /*!< Sends escaped frames of the request */
+    static size_t encode_advanced(uint8_t *dst, uint8_t address, uint8_t control, const uint8_t *info, size_t len); /*!< Encodes one escaped frame */
+    void on_cmux_advanced(const uint8_t *data, size_t len); /*!< Unescapes received data and splits them to frames */
+    void append_advanced(const uint8_t *data, size_t len, uint8_t mask); /*!< Appends unescaped data to the received frame */
+    void on_advanced_frame();                           /*!< Called when complete advanced option frame received */
+
     struct CMuxFrame;                                   /*!< Forward declare the Frame struct, used in protocol decoders */
     /**
      * These methods serve different states of the CMUX protocols
@@ -99,7 +281,59 @@ private:
     bool on_payload(CMuxFrame &frame);
     bool on_footer(CMuxFrame &frame);
 
-    std::function<bool(uint8_t *data, size_t len)> read_cb[MAX_TERMINALS_NUM];  /*!< Function pointers to read callbacks */
+    /**
+     * Receive ring buffer of a DLC
+     *
+     * Payload of the currently received frame is appended as pending and becomes available to readers
+     * only after the frame has been verified (committed). Available data are accessible in place,
+     * in one or two contiguous segments if the ring wraps around.
+     */
+    struct RxRing {
+        std::unique_ptr<uint8_t[]> data;
+        size_t capacity{0};
+        size_t head{0};                                 /*!< Position of the oldest available byte */
+        size_t available{0};                            /*!< Bytes of the committed frames */
+        size_t pending{0};                              /*!< Bytes of the frame being received */
+        void allocate(size_t size);
+        bool append(const uint8_t *src, size_t len);    /*!< Appends payload of the current frame, false if it doesn't fit */
+        size_t segment(uint8_t **ptr) const;            /*!< Returns the first contiguous segment of available data */
+        void release(size_t len);                       /*!< Releases data consumed by the reader */
+        void commit()
+        {
+            available += pending;
+            pending = 0;
+        }
+        void drop()
+        {
+            pending = 0;
+        }
+    };
+
+    /**
+     * State of the virtual terminal (DLC)
+     */
+    struct Dlci {
+        std::function<bool(uint8_t *data, size_t len)> read_cb;  /*!< Read callback of the virtual terminal */
+        size_t frame_size{127};                                  /*!< Maximum frame size (N1) used for writing */
+        bool open{false};                                        /*!< DLC established */
+        bool opening{false};                                     /*!< SABM sent, the DLC is established by its UA */
+        uint8_t priority{7};                                     /*!< Transmit priority (0 is the highest) */
+        TxQueue tx_queue;                                        /*!< Pending write requests */
+        cmux_tx_stats tx_stats{};                                /*!< Transmit statistics */
+        RxRing rx;                                               /*!< Received data */
+        uint32_t connect_timeout_ms;                             /*!< Timeout of SABM/DISC acknowledgement */
+        uint32_t connect_retries;                                /*!< Retransmissions of SABM/DISC */
+        bool tx_stopped{false};                                  /*!< Modem signalled flow off (MSC) */
+        bool rx_stopped{false};                                  /*!< We signalled flow off, receive ring is full */
+        bool rx_discard{false};                                  /*!< Read callback removed, received data are dropped */
+        bool delivering{false};                                  /*!< Data are being posted to the read callback */
+    };
+
+    std::vector<Dlci> dlcis;                          /*!< Virtual terminals indexed by DLCI - 1 */
+    TxQueue control_queue;                            /*!< Pending complete frames (control channel, SABM, DISC) */
+    size_t tx_pending{0};                             /*!< Number of pending write requests */
+    bool tx_flow_off{false};                          /*!< Modem signalled flow off of all DLCs (FCOFF) */
+    bool tx_abort{false};                             /*!< Link down or destroying, the writers stopped by flow control give up */
     std::unique_ptr<Terminal> term;                   /*!< The original terminal */
     cmux_state state;                                 /*!< CMux protocol state */
 
@@ -109,20 +343,53 @@ private:
     uint8_t dlci;
     uint8_t type;
     size_t payload_len;
-    uint8_t frame_header[6];
+    uint8_t frame_header[7];
     size_t frame_header_offset;
-    uint8_t *payload_start;
-    size_t total_payload_size;
     int instance;
-    int sabm_ack;
+    int pn_ack;
+    uint64_t ua_received;                             /*!< Bitmask of DLCIs which acknowledged SABM/DISC */
+    uint64_t dm_received;                             /*!< Bitmask of DLCIs which rejected SABM */
+    uint32_t connect_timeout_ms;                      /*!< Timeout of SABM/DISC acknowledgement (control channel) */
+    uint32_t connect_retries;                         /*!< Retransmissions of SABM/DISC (control channel) */
+    SignalGroup signal;                               /*!< Bit per DLCI set on its UA/DM, shared for higher DLCIs */
+
+    /**
+     * Keep-alive configuration and state
+     */
+    uint32_t keepalive_interval_ms;
+    uint32_t keepalive_timeout_ms;
+    uint32_t keepalive_max_misses;
+    uint32_t test_received;                           /*!< Sequence number of the last test response */
+    cmux_keepalive_stats keepalive_state;
+    std::function<void()> link_down_cb;
+    std::unique_ptr<Task> keepalive_task;
+    uint8_t frame_fcs;                                /*!< Running FCS of the currently received frame */
+    size_t fcs_errors;                                /*!< Number of frames dropped on FCS mismatch */
+    RxRing control_rx;                                /*!< Received control channel message */
+    bool rx_dropping;                                 /*!< Currently received frame doesn't fit its ring */
+    size_t rx_overflows;                              /*!< Number of frames dropped on full ring */
+    size_t rx_buffer_size;                            /*!< Size of the receive ring of each terminal */
+
+    size_t max_frame_size;                            /*!< Frame size (N1) to negotiate */
 
     /**
-     * Processing buffer size and pointer
+     * Processing buffer size and pointer (bulk reads of the original terminal)
      */
     size_t buffer_size;
     std::unique_ptr<uint8_t[]> buffer;
 
-    Lock lock;
+    /**
+     * Advanced option buffers and decoder state (buffers allocated only if the advanced option is used)
+     */
+    std::unique_ptr<uint8_t[]> advanced_frame;        /*!< Unescaped received frame */
+    size_t advanced_frame_len{0};
+    bool advanced_escaped{false};                     /*!< Previous byte was control escape */
+    bool advanced_overflow{false};                    /*!< Received frame is dropped (too long or aborted) */
+    std::unique_ptr<uint8_t[]> tx_buffer;             /*!< Escaped frames to write */
+    size_t tx_buffer_size{0};
+
+    Lock lock;                                        /*!< Serializes frames written to the terminal */
+    Lock state_lock;                                  /*!< Guards DLCI table and handshake state shared with receiving task */
 };
 
 /**
@@ -143,7 +410,11 @@ public:
     }
     int read(uint8_t *data, size_t len) override
     {
-        return  0;
+        return cmux->read(instance, data, len);
+    }
+    size_t queued_bytes() override
+    {
+        return cmux->queued_bytes();
     }
     void start() override { }
     void stop() override { }
@@ -86,6 +86,23 @@ public:
         return dte->command(command, std::move(got_line), time_ms);
     }
 
+    command_result command(const std::string &command, line_cb got_line, uint32_t time_ms)
+    {
+        return dte->command(command, std::move(got_line), time_ms);
+    }
+
+    /**
+     * @brief Switches the modem to the new baud rate (AT+IPR) and on success follows with the DTE
+     */
+    command_result switch_baud_rate(int baud_rate)
+    {
+        auto ret = device->set_baud(baud_rate);
+        if (ret == command_result::OK && !dte->set_baud_rate(baud_rate)) {
+            return command_result::FAIL;
+        }
+        return ret;
+    }
+
     bool set_mode(modem_mode m)
     {
         return mode.set(dte.get(), device.get(), netif, m);
@@ -81,6 +81,9 @@ public:
         } else if (mode == modem_mode::COMMAND_MODE) {
             return set_command_mode() == command_result::OK;
         } else if (mode == modem_mode::CMUX_MODE) {
+            if (dte->cmux_option() == ESP_MODEM_CMUX_ADVANCED_OPTION) {
+                return set_cmux_advanced() == command_result::OK;
+            }
             return set_cmux() == command_result::OK;
         }
         return true;
@@ -15,6 +15,9 @@
 #pragma once
 
 #include <memory>
+#include <deque>
+#include <vector>
+#include <future>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -22,6 +25,7 @@
 #include "cxx_include/esp_modem_terminal.hpp"
 #include "cxx_include/esp_modem_cmux.hpp"
 #include "cxx_include/esp_modem_types.hpp"
+#include "cxx_include/esp_modem_urc.hpp"
 
 struct esp_modem_dte_config;
 
@@ -35,6 +39,20 @@ namespace esp_modem {
 * @{
 */
 
+/**
+ * @brief Usage statistics of the DTE receive buffer
+ */
+struct dte_buffer_stats {
+    size_t high_water;          /*!< Maximum number of bytes held for an unfinished response */
+    size_t overflows;           /*!< Number of times a response didn't fit into the buffer */
+    size_t dropped;             /*!< Number of bytes discarded by the drop-oldest policy */
+};
+
+/**
+ * @brief Callback receiving an unsolicited result code (the line refers to the DTE buffer, valid only during the call)
+ */
+typedef std::function<void(std::string_view line)> urc_cb;
+
 /**
  * DTE (Data Terminal Equipment) class
  */
@@ -49,16 +67,47 @@ public:
     explicit DTE(const esp_modem_dte_config *config, std::unique_ptr<Terminal> t);
     explicit DTE(std::unique_ptr<Terminal> t);
 
-    ~DTE() = default;
+    ~DTE();
 
     /**
      * @brief Writing to the underlying terminal
+     *
+     * In data mode with TX coalescing enabled, small writes are collected and sent together
+     * when the coalescing buffer fills up, on flush(), or after the configured latency
      * @param data Data pointer to write
      * @param len Data len to write
      * @return number of bytes written
      */
     int write(uint8_t *data, size_t len);
 
+    /**
+     * @brief Sends the coalesced data immediately
+     */
+    void flush();
+
+    /**
+     * @brief Changes the baud rate of the serial line, after the pending data have been sent
+     *
+     * @note Not available in CMUX mode, as the multiplexed terminals do not control the line
+     * @return true on success, false if the terminal does not support it
+     */
+    bool set_baud_rate(int baud_rate);
+
+    /**
+     * @brief Returns the number of bytes written but not yet passed to the device
+     * (coalesced by the DTE or queued by the terminal while its output would block)
+     */
+    size_t queued_bytes();
+
+    /**
+     * @brief Sets the callback notifying that the terminal transmitted its queued data,
+     * so that writes are fully accepted again
+     */
+    void set_writable_cb(std::function<void()> f)
+    {
+        term->set_writable_cb(std::move(f));
+    }
+
     /**
      * @brief Reading from the underlying terminal
      * @param d Returning the data pointer of the received payload
@@ -80,6 +129,35 @@ public:
      */
     [[nodiscard]] bool set_mode(modem_mode m);
 
+    /**
+     * @brief Opens an additional CMUX virtual terminal (DTE has to be in CMUX mode)
+     * @param inst Index of the virtual terminal, 0 and 1 are used by DTE for commands and data
+     * @return Virtual terminal on success, nullptr otherwise
+     */
+    std::unique_ptr<Terminal> open_cmux_terminal(int inst);
+
+    /**
+     * @brief Closes the CMUX virtual terminal previously opened by open_cmux_terminal()
+     * @param inst Index of the virtual terminal
+     * @return true on success
+     */
+    bool close_cmux_terminal(int inst);
+
+    /**
+     * @brief Sets callback to be notified when the CMUX keep-alive detects the link down
+     * (keep-alive is enabled by cmux_config.keepalive_interval_ms)
+     * @param f Function to be called from the keep-alive task
+     */
+    void set_cmux_link_down_cb(std::function<void()> f);
+
+    /**
+     * @brief Framing option used in CMUX mode (the modem has to be switched to CMUX with the same option)
+     */
+    esp_modem_cmux_option_t cmux_option() const
+    {
+        return cmux_config.option;
+    }
+
     /**
      * @brief Sends command and provides callback with responding line
      * @param command String parameter representing command
@@ -94,20 +172,129 @@ public:
      */
     command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, char separator) override;
 
+    /**
+     * @brief Sends command and delivers each complete line of the response to the callback
+     *
+     * Only the newly received bytes are scanned for the separator, partial lines are carried over
+     * to the next chunk, so the parsing cost is linear with the response length.
+     * @param command String parameter representing command
+     * @param got_line Function to be called for every received line (without the separator and trailing CR)
+     * @param time_ms Time in ms to wait for the answer
+     * @param separator Line separator
+     * @return OK, FAIL, TIMEOUT
+     */
+    command_result command(const std::string &command, line_cb got_line, uint32_t time_ms, char separator = '\n') override;
+
+    /**
+     * @brief Resizes the DTE buffer, not available in data and CMUX modes
+     * @param size New size in bytes
+     * @return false if the buffer is in use by the data or CMUX mode
+     */
+    bool set_buffer_size(size_t size);
+
+    /**
+     * @brief Sets handling of command responses exceeding the DTE buffer
+     */
+    void set_overflow_policy(esp_modem_dte_overflow_policy_t policy)
+    {
+        overflow_policy = policy;
+    }
+
+    /**
+     * @brief Returns usage statistics of the DTE buffer
+     */
+    dte_buffer_stats buffer_stats() const
+    {
+        return stats;
+    }
+
+    /**
+     * @brief Subscribes to unsolicited result codes starting with the prefix
+     *
+     * Matching lines are routed to the callback both when the DTE is idle and during commands
+     * (in which case the command doesn't see them), except for the lines starting with the
+     * response prefix of the active command (e.g. "+CREG" for "AT+CREG?").
+     * Must not be called from within a URC or command callback.
+     * @param prefix Beginning of the URC line, e.g. "+CREG:", "RING" or "NO CARRIER"
+     * @param f Callback, nullptr to unsubscribe
+     * @return false if the prefix is empty or not subscribed (when unsubscribing)
+     */
+    bool set_urc_cb(const std::string &prefix, urc_cb f);
+
+    /**
+     * @brief Queues the command without blocking the caller
+     *
+     * Commands are sent one after another by a dispatcher task (started on first use), the next one
+     * right after the final result of the previous one. Synchronous commands are serialized with the queue.
+     * @param command String parameter representing command
+     * @param got_line Function to be called for every received line (from the dispatcher task)
+     * @param time_ms Time in ms to wait for the answer
+     * @param done Function to be called with the final result (from the dispatcher task)
+     * @return false if the command queue is full
+     */
+    bool command_async(const std::string &command, line_cb got_line, uint32_t time_ms, std::function<void(command_result)> done);
+
+    /**
+     * @brief Queues the command (same as above) and provides the result as a future
+     * @return Future result of the command, FAIL if the command queue is full
+     */
+    std::future<command_result> command_async(const std::string &command, line_cb got_line, uint32_t time_ms);
+
 private:
     static const size_t GOT_LINE = SignalGroup::bit0;       /*!< Bit indicating response available */
+    static const size_t COMMAND_QUEUED = SignalGroup::bit1; /*!< Bit indicating pending asynchronous commands */
+    static const size_t TASKS_STOP = SignalGroup::bit2;     /*!< Bit requesting the DTE tasks to exit */
+    static const size_t TX_QUEUED = SignalGroup::bit3;      /*!< Bit indicating coalesced data waiting for transmission */
+
+    /**
+     * @brief Pending asynchronous command
+     */
+    struct AsyncCommand {
+        std::string command;
+        line_cb got_line;
+        uint32_t time_ms;
+        std::function<void(command_result)> done;
+    };
 
     [[nodiscard]] bool setup_cmux();                         /*!< Internal setup of CMUX mode */
+    command_result frame_lines(const uint8_t *data, size_t len, char separator, const line_cb &got_line); /*!< Splits the received chunk into lines */
+    void dispatch();                                         /*!< Sends the queued asynchronous commands */
+    void flush_tx();                                         /*!< Writes the coalesced data (tx_lock taken) */
+    void tx_flusher();                                       /*!< Flushes the coalesced data after the latency bound */
+    bool make_room(char separator);                          /*!< Applies the overflow policy to the full buffer */
+    bool dispatch_urc(std::string_view line);                /*!< Routes the line to a URC subscriber if it matches */
+    size_t route_urcs(uint8_t *data, size_t end, char separator); /*!< Routes and removes the URC lines of the buffer */
+    void set_idle_read_cb();                                 /*!< Listens for URCs on the command terminal while no command runs */
 
     Lock lock{};                                            /*!< Locks DTE operations */
     size_t buffer_size;                                      /*!< Size of available DTE buffer */
     size_t consumed;                                         /*!< Indication of already processed portion in DTE buffer */
     std::unique_ptr<uint8_t[]> buffer;                       /*!< DTE buffer */
+    std::string line;                                        /*!< Incomplete line carried over to the next received chunk */
+    esp_modem_cmux_config cmux_config;                       /*!< Configuration of the CMUX mode */
     std::unique_ptr<Terminal> term;                          /*!< Primary terminal for this DTE */
     Terminal *command_term;                                  /*!< Reference to the terminal used for sending commands */
     std::unique_ptr<Terminal> other_term;                    /*!< Secondary terminal for this DTE */
+    std::shared_ptr<CMux> cmux_term;                         /*!< CMUX multiplexer if running in CMUX mode */
+    std::function<void()> cmux_link_down_cb;                 /*!< Notification of CMUX link down */
     modem_mode mode;                                         /*!< DTE operation mode */
     SignalGroup signal;                                     /*!< Event group used to signal request-response operations */
+    Lock urc_lock{};                                         /*!< Protects the URC subscriptions */
+    UrcTrie urc_trie;                                        /*!< Registered URC prefixes */
+    std::vector<urc_cb> urc_handlers;                        /*!< URC subscribers, indexed by the trie ids */
+    std::string solicited_prefix;                            /*!< Response prefix of the active command, never treated as URC */
+    Lock queue_lock{};                                       /*!< Protects the asynchronous command queue */
+    std::deque<AsyncCommand> command_queue;                  /*!< Pending asynchronous commands */
+    size_t command_queue_size;                               /*!< Maximum number of pending asynchronous commands */
+    std::unique_ptr<Task> dispatcher;                        /*!< Task sending the asynchronous commands */
+    esp_modem_dte_overflow_policy_t overflow_policy;         /*!< Handling of responses exceeding the buffer */
+    Lock tx_lock{};                                          /*!< Protects the TX coalescing buffer */
+    size_t tx_coalesce_size;                                 /*!< Size of the TX coalescing buffer, 0 if disabled */
+    uint32_t tx_latency_ms;                                  /*!< Latency bound of the coalesced data (at least one scheduler tick on FreeRTOS) */
+    size_t tx_pending{0};                                    /*!< Number of coalesced bytes */
+    std::unique_ptr<uint8_t[]> tx_buffer;                    /*!< TX coalescing buffer */
+    std::unique_ptr<Task> tx_task;                           /*!< Task flushing the coalesced data in time */
+    dte_buffer_stats stats{};                                /*!< Buffer usage statistics */
     std::function<bool(uint8_t *data, size_t len)> on_data;  /*!< on data callback for current terminal */
 };
 
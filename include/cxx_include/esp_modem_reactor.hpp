@@ -0,0 +1,119 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_REACTOR
+ * @brief Shared I/O reactor for file descriptor terminals (Linux only)
+ */
+
+/** @addtogroup ESP_MODEM_REACTOR
+* @{
+*/
+
+/**
+ * @brief epoll based reactor dispatching the I/O events of many file descriptors from one thread (or a small pool)
+ *
+ * Each descriptor is watched in one-shot mode, so its callbacks never run concurrently, even with more threads.
+ * Readability is watched from add() on, writability only on request (see rearm_writable())
+ */
+class Reactor {
+public:
+    /**
+     * @brief Creates the reactor
+     * @param threads Number of threads dispatching the events
+     */
+    explicit Reactor(size_t threads = 1);
+
+    /**
+     * @brief Stops the threads immediately (wakes them up through an eventfd)
+     */
+    ~Reactor();
+
+    /**
+     * @brief Starts watching the file descriptor
+     * @param fd File descriptor
+     * @param on_readable Function called when the descriptor becomes readable; returns true to keep watching,
+     * false to pause until rearm() is called
+     * @param on_writable Function called when the descriptor becomes writable; returns true to keep watching,
+     * false to stop until rearm_writable() is called
+     * @return false on failure (e.g. the descriptor is already watched)
+     */
+    bool add(int fd, std::function<bool()> on_readable, std::function<bool()> on_writable = nullptr);
+
+    /**
+     * @brief Resumes watching of a paused descriptor
+     */
+    bool rearm(int fd);
+
+    /**
+     * @brief Starts watching the writability of the descriptor (e.g. when its output would block)
+     */
+    bool rearm_writable(int fd);
+
+    /**
+     * @brief Stops watching the file descriptor
+     *
+     * When it returns, the callback of the descriptor is not running (unless called from the callback itself)
+     * and will not be called anymore
+     */
+    void remove(int fd);
+
+private:
+    struct Entry {
+        std::function<bool()> on_readable;
+        std::function<bool()> on_writable;
+        std::recursive_mutex busy;      /*!< Held while the callback runs */
+        bool active = true;
+        bool read = true;               /*!< Readability is watched */
+        bool write = false;             /*!< Writability is watched */
+        bool running = false;           /*!< Callbacks are running, so the descriptor is armed afterwards */
+        bool rearm_read = false;        /*!< rearm() requested while running */
+        bool rearm_write = false;       /*!< rearm_writable() requested while running */
+    };
+
+    void run();
+    void dispatch(int fd, uint32_t events);
+    bool arm(int fd, int op, const Entry &entry);
+    bool rearm(int fd, bool read, bool write);
+
+    int epoll_fd;
+    int wake_fd;                        /*!< eventfd waking up the threads on destruction */
+    std::mutex lock;
+    std::map<int, std::shared_ptr<Entry>> entries;
+    std::vector<std::thread> threads;
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
+
+/**
+ * @brief Reactor handle referenced from the VFS terminal configuration
+ */
+struct esp_modem_reactor : public esp_modem::Reactor {
+    using esp_modem::Reactor::Reactor;
+};
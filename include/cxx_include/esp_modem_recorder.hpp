@@ -0,0 +1,154 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cxx_include/esp_modem_terminal.hpp"
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_RECORDER
+ * @brief Recording and replaying the raw byte stream of a terminal (Linux only)
+ */
+
+/** @addtogroup ESP_MODEM_RECORDER
+* @{
+*/
+
+/**
+ * @brief Terminal decorator recording every read and write of the wrapped terminal
+ *
+ * The log is a memory-mapped, append-only file: a header (magic "EMRL", version, valid length),
+ * followed by records of a type byte (0 read, 1 write), LEB128 encoded time since the previous record
+ * in microseconds (monotonic clock), LEB128 encoded length and the data. The valid length in the header
+ * is updated after each record, so the log is usable even if the process does not exit cleanly.
+ * Writes are recorded before passing them to the terminal, so that the responses always follow
+ * their commands in the log (even if the wrapped terminal responds from within the write).
+ */
+class RecordingTerminal: public Terminal {
+public:
+    /**
+     * @brief Creates the log and wraps the terminal
+     * @param t Terminal to record
+     * @param path Path of the log, truncated if exists
+     * @param capacity Initial size of the mapping, the log grows when full (0 defaults to 1 MiB)
+     */
+    explicit RecordingTerminal(std::unique_ptr<Terminal> t, const char *path, size_t capacity = 0);
+
+    ~RecordingTerminal() override;
+
+    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override;
+    void set_writable_cb(std::function<void()> f) override;
+    size_t queued_bytes() override;
+    int write(uint8_t *data, size_t len) override;
+    int writev(const struct iovec *iov, size_t count) override;
+    int read(uint8_t *data, size_t len) override;
+    bool set_baud_rate(int baud_rate) override;
+    void start() override;
+    void stop() override;
+
+    /**
+     * @brief Size of the log in bytes
+     */
+    size_t log_size();
+
+private:
+    void record(uint8_t type, const struct iovec *iov, size_t count, size_t len);
+
+    std::unique_ptr<Terminal> term;
+    std::mutex log_lock;                                /*!< Reads and writes come from different threads */
+    int fd{-1};
+    uint8_t *map{nullptr};
+    size_t capacity;
+    size_t used;
+    int64_t last_us;                                    /*!< Time of the previous record */
+};
+
+/**
+ * @brief Terminal replaying the reads of a recorded log, e.g. to run a captured session through DTE/CMux
+ *
+ * Writes are accepted and counted, but never sent anywhere. To keep the responses after the commands
+ * which triggered them, reads recorded after a write are replayed only when the same number of bytes
+ * has been written (or the sync timeout expires). The data not consumed after the last record are offered
+ * again until read or the replay is stopped.
+ */
+class ReplayTerminal: public Terminal {
+public:
+    /**
+     * @brief Loads the log
+     * @param path Path of the log recorded by RecordingTerminal
+     * @param realtime true to keep the recorded timing, false to replay as fast as possible
+     * @param write_sync_ms Maximum time to wait for the writes preceding the next read, 0 not to wait
+     */
+    explicit ReplayTerminal(const char *path, bool realtime = false, uint32_t write_sync_ms = 1000);
+
+    ~ReplayTerminal() override;
+
+    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override;
+    int write(uint8_t *data, size_t len) override;
+    int read(uint8_t *data, size_t len) override;
+
+    /**
+     * @brief Starts replaying from the beginning of the log
+     */
+    void start() override;
+    void stop() override;
+
+    /**
+     * @brief Waits until all the reads have been replayed and consumed
+     * @return true if finished in time
+     */
+    bool wait_until_done(uint32_t timeout_ms);
+
+    /**
+     * @brief Total length of the recorded reads
+     */
+    size_t read_bytes() const
+    {
+        return total_read;
+    }
+
+private:
+    static constexpr uint32_t REDELIVER_MS = 10;       /*!< Period of offering the data left after the last record */
+
+    void replay();
+    bool deliver();
+
+    uint8_t *log{nullptr};                              /*!< Read-only mapping of the log */
+    size_t log_len{0};                                  /*!< Size of the mapping */
+    size_t log_end{0};                                  /*!< End of the complete records */
+    bool realtime;
+    uint32_t write_sync_ms;
+    size_t total_read{0};
+    std::mutex lock;
+    std::condition_variable cv;                         /*!< Signals the writes, consumed data and stop */
+    std::vector<uint8_t> pending;                       /*!< Replayed data not yet read */
+    size_t written{0};
+    bool running{false};
+    bool finished{false};                               /*!< All the reads have been replayed */
+    std::thread replay_thread;
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
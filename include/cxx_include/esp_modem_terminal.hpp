@@ -20,6 +20,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <utility>
+#include <sys/uio.h>
 #include "esp_err.h"
 #include "esp_modem_primitives.hpp"
 
@@ -60,14 +61,51 @@ public:
         on_read = std::move(f);
     }
 
+    /**
+     * @brief Sets the callback notifying that the data queued by write() have been transmitted,
+     * so that the terminal accepts the full length of writes again
+     */
+    virtual void set_writable_cb(std::function<void()> f)
+    {
+        on_writable = std::move(f);
+    }
+
+    /**
+     * @brief Returns the number of bytes accepted by write() but not yet passed to the device
+     *
+     * @note Terminals without an outbound queue always return 0
+     */
+    virtual size_t queued_bytes()
+    {
+        return 0;
+    }
+
     /**
      * @brief Writes data to the terminal
      * @param data Data pointer
      * @param len Data len
-     * @return length of data written
+     * @return length of data written (or queued for transmission), shorter than len if the terminal is congested
      */
     virtual int write(uint8_t *data, size_t len) = 0;
 
+    /**
+     * @brief Writes data scattered in multiple buffers to the terminal
+     *
+     * @note Default implementation writes the buffers one by one,
+     * terminals capable of gathering writes should override it
+     * @param iov Array of buffers to write
+     * @param count Number of buffers in the array
+     * @return length of data written
+     */
+    virtual int writev(const struct iovec *iov, size_t count)
+    {
+        int total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += write(static_cast<uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+        }
+        return total;
+    }
+
     /**
      * @brief Read from the terminal. This function doesn't block, but return all available data.
      * @param data Data pointer to store the read payload
@@ -76,6 +114,15 @@ public:
      */
     virtual int read(uint8_t *data, size_t len) = 0;
 
+    /**
+     * @brief Changes the baud rate of the underlying serial line
+     * @return false if not supported by the terminal (or failed)
+     */
+    virtual bool set_baud_rate(int baud_rate)
+    {
+        return false;
+    }
+
     virtual void start() = 0;
 
     virtual void stop() = 0;
@@ -83,6 +130,7 @@ public:
 protected:
     std::function<bool(uint8_t *data, size_t len)> on_read;
     std::function<void(terminal_error)> on_error;
+    std::function<void()> on_writable;
 };
 
 /**
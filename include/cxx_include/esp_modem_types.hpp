@@ -16,6 +16,7 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
 #include <cstddef>
 #include <cstdint>
 
@@ -47,11 +48,17 @@ enum class modem_mode {
 enum class command_result {
     OK,             /*!< The command completed successfully */
     FAIL,           /*!< The command explicitly failed */
-    TIMEOUT         /*!< The device didn't respond in the specified timeline */
+    TIMEOUT,        /*!< The device didn't respond in the specified timeline */
+    BUFFER_OVERFLOW /*!< The response didn't fit into the DTE buffer (with the fail-fast overflow policy) */
 };
 
 typedef std::function<command_result(uint8_t *data, size_t len)> got_line_cb;
 
+/**
+ * @brief Callback receiving one complete response line (without the separator and the trailing CR)
+ */
+typedef std::function<command_result(std::string_view line)> line_cb;
+
 /**
  * @brief PDP context used for configuring and setting the data mode up
  */
@@ -76,6 +83,16 @@ public:
      */
     virtual command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator) = 0;
     virtual command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms) = 0;
+
+    /**
+     * @brief Sends custom AT command and delivers the response line by line
+     * @param command Command to be sent
+     * @param got_line callback called once for each new (non-empty) line
+     * @param time_ms timeout in milliseconds
+     * @param separator line separator
+     * @return OK, FAIL or TIMEOUT
+     */
+    virtual command_result command(const std::string &command, line_cb got_line, uint32_t time_ms, const char separator = '\n') = 0;
 };
 
 /**
@@ -0,0 +1,95 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_URC
+ * @brief Matching of unsolicited result codes
+ */
+
+/** @addtogroup ESP_MODEM_URC
+* @{
+*/
+
+/**
+ * @brief Compact prefix trie mapping the registered URC prefixes to subscriber ids
+ *
+ * Nodes are kept in a flat array, linked as first child and next sibling,
+ * so matching a line costs one pass over the matching prefix.
+ */
+class UrcTrie {
+public:
+    static constexpr int NO_MATCH = -1;
+
+    /**
+     * @brief Adds (or replaces) the prefix
+     * @param prefix URC prefix, e.g. "+CREG:" or "RING"
+     * @param id Subscriber id to be returned by match()
+     * @return false if the prefix is empty
+     */
+    bool insert(std::string_view prefix, int id);
+
+    /**
+     * @brief Removes the prefix
+     * @return false if the prefix wasn't registered
+     */
+    bool remove(std::string_view prefix);
+
+    /**
+     * @brief Finds exactly the prefix (not a shorter prefix of it)
+     * @return Subscriber id of the prefix or NO_MATCH if not registered
+     */
+    int find(std::string_view prefix) const;
+
+    /**
+     * @brief Finds the longest registered prefix of the line
+     * @return Subscriber id or NO_MATCH
+     */
+    int match(std::string_view line) const;
+
+    bool empty() const
+    {
+        return entries == 0;
+    }
+
+private:
+    static constexpr uint16_t NONE = 0;         /*!< Node index 0 is the root, so it can't be a child or a sibling */
+
+    struct Node {
+        char c;
+        int id;
+        uint16_t child;
+        uint16_t sibling;
+    };
+
+    uint16_t find_child(uint16_t node, char c) const;
+    uint16_t find_node(std::string_view prefix) const;
+
+    std::vector<Node> nodes{ { 0, NO_MATCH, NONE, NONE } };
+    size_t entries = 0;
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
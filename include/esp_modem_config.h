@@ -40,6 +40,16 @@ typedef enum {
     ESP_MODEM_FLOW_CONTROL_HW
 } esp_modem_flow_ctrl_t;
 
+/**
+ * @brief Trade-off between the response latency and the number of receive wake-ups of the serial line
+ *
+ */
+typedef enum {
+    ESP_MODEM_SERIAL_LATENCY_DEFAULT = 0,   /*!< Platform defaults */
+    ESP_MODEM_SERIAL_LOW_LATENCY,           /*!< Wake up on every received byte, ask the driver to skip its latency timer */
+    ESP_MODEM_SERIAL_THROUGHPUT             /*!< Wake up once a block of data is received, the rest is picked up periodically */
+} esp_modem_serial_latency_t;
+
 /**
  * @brief UART configuration structure
  *
@@ -58,11 +68,24 @@ struct esp_modem_uart_term_config {
     int rx_buffer_size;             /*!< UART RX Buffer Size */
     int tx_buffer_size;             /*!< UART TX Buffer Size */
     int event_queue_size;           /*!< UART Event Queue Size, set to 0 if no event queue needed */
+    esp_modem_serial_latency_t latency_profile; /*!< Receive latency profile */
 };
 
 // Forward declare the resource struct
 struct esp_modem_vfs_resource;
 
+// Forward declare the shared I/O reactor (Linux only)
+struct esp_modem_reactor;
+
+/**
+ * @brief I/O mechanism of the VFS terminal
+ *
+ */
+typedef enum {
+    ESP_MODEM_VFS_IO_SELECT = 0,    /*!< Readiness notification (select() task or the shared reactor), then read()/write() */
+    ESP_MODEM_VFS_IO_URING          /*!< io_uring with pre-posted reads into registered buffers (Linux only) */
+} esp_modem_vfs_io_t;
+
 /**
  * @brief VFS configuration structure
  *
@@ -71,8 +94,50 @@ struct esp_modem_vfs_term_config {
     int fd;                                     /*!< Already created file descriptor */
     void (*deleter)(int, struct esp_modem_vfs_resource*);             /*!< Custom close function for the fd */
     struct esp_modem_vfs_resource *resource;    /*!< Resource attached to the VFS (need for clenaup) */
+    bool (*set_baud_rate)(int, struct esp_modem_vfs_resource*, int);  /*!< Changes the baud rate of the serial line (nullptr if not supported) */
+    struct esp_modem_reactor *reactor;          /*!< Shared I/O reactor (Linux only), nullptr to use a task per terminal */
+    esp_modem_vfs_io_t io_backend;              /*!< I/O mechanism */
+    size_t tx_queue_size;                       /*!< Maximum size of the data queued while the fd would block, 0 defaults to 8192 bytes */
+    uint32_t read_poll_ms;                      /*!< Period of picking up data below the wake-up threshold of the fd, 0 if it wakes up on every byte */
+    int (*reconnect)(struct esp_modem_vfs_resource*);   /*!< Opens the lost connection again, returns the new fd or -1 (nullptr if not supported) */
+    uint32_t reconnect_min_ms;                  /*!< Delay before the first reconnection attempt, doubled after each failure */
+    uint32_t reconnect_max_ms;                  /*!< Maximum delay between the reconnection attempts */
+};
+
+/**
+ * @brief CMUX framing option
+ *
+ */
+typedef enum {
+    ESP_MODEM_CMUX_BASIC_OPTION = 0,        /*!< Basic option, frames delimited by 0xF9 with length field (AT+CMUX=0) */
+    ESP_MODEM_CMUX_ADVANCED_OPTION          /*!< Advanced option, frames delimited by 0x7E with control-escape transparency (AT+CMUX=1) */
+} esp_modem_cmux_option_t;
+
+/**
+ * @brief CMUX configuration structure
+ *
+ */
+struct esp_modem_cmux_config {
+    size_t max_frame_size;          /*!< Maximum frame size (N1) to negotiate per DLC, 0 keeps the basic default of 127 bytes */
+    size_t terminals_num;           /*!< Number of virtual terminals (up to 63), 0 keeps the default of 2 (command and data) */
+    size_t rx_buffer_size;          /*!< Size of the receive ring buffer of each virtual terminal, 0 defaults to two maximum frames */
+    uint32_t connect_timeout_ms;    /*!< Time to wait for the modem to acknowledge SABM/DISC of a DLC, 0 defaults to 1000 ms */
+    uint32_t connect_retries;       /*!< Number of SABM/DISC retransmissions if not acknowledged in time */
+    uint32_t keepalive_interval_ms; /*!< Period of keep-alive test messages on the control channel, 0 disables the keep-alive */
+    uint32_t keepalive_timeout_ms;  /*!< Time to wait for the keep-alive response, 0 defaults to 1000 ms */
+    uint32_t keepalive_max_misses;  /*!< Number of consecutive missed responses to declare the link down, 0 defaults to 3 */
+    esp_modem_cmux_option_t option; /*!< Framing option */
 };
 
+/**
+ * @brief Handling of command responses exceeding the DTE buffer
+ *
+ */
+typedef enum {
+    ESP_MODEM_DTE_OVERFLOW_DROP_OLDEST = 0, /*!< Discard the oldest (already processed) data and keep receiving */
+    ESP_MODEM_DTE_OVERFLOW_FAIL             /*!< Finish the command immediately with BUFFER_OVERFLOW result */
+} esp_modem_dte_overflow_policy_t;
+
 /**
  * @brief Complete DTE configuration structure
  *
@@ -84,6 +149,12 @@ struct esp_modem_dte_config {
     size_t dte_buffer_size;                             /*!< DTE buffer size */
     uint32_t task_stack_size;                           /*!< Terminal task stack size */
     int task_priority;                                  /*!< Terminal task priority */
+    struct esp_modem_cmux_config cmux_config;           /*!< Configuration of the CMUX mode */
+    size_t command_queue_size;                          /*!< Maximum number of pending asynchronous commands, 0 defaults to 8 */
+    esp_modem_dte_overflow_policy_t overflow_policy;    /*!< Handling of command responses exceeding the DTE buffer */
+    size_t tx_coalesce_size;                            /*!< Size of the buffer coalescing small data mode writes (flushed when full), 0 disables coalescing */
+    uint32_t tx_coalesce_latency_us;                    /*!< Maximum time the coalesced data wait for transmission, 0 defaults to 1000 us (rounded up to whole milliseconds, on FreeRTOS to scheduler ticks) */
+    const char *record_path;                            /*!< Log file recording the raw byte stream of the terminal (Linux only), NULL to disable */
     union {
         struct esp_modem_uart_term_config uart_config;      /*!< Configuration for UART Terminal */
         struct esp_modem_vfs_term_config vfs_config;        /*!< Configuration for VFS Terminal */
@@ -100,6 +171,22 @@ struct esp_modem_dte_config {
         .dte_buffer_size = 512,        \
         .task_stack_size = 4096, \
         .task_priority = 5,      \
+        .cmux_config = {         \
+            .max_frame_size = 0, \
+            .terminals_num = 0,  \
+            .rx_buffer_size = 0, \
+            .connect_timeout_ms = 0, \
+            .connect_retries = 0, \
+            .keepalive_interval_ms = 0, \
+            .keepalive_timeout_ms = 0, \
+            .keepalive_max_misses = 0, \
+            .option = ESP_MODEM_CMUX_BASIC_OPTION, \
+        },                       \
+        .command_queue_size = 0, \
+        .overflow_policy = ESP_MODEM_DTE_OVERFLOW_DROP_OLDEST, \
+        .tx_coalesce_size = 0,   \
+        .tx_coalesce_latency_us = 0, \
+        .record_path = NULL,     \
         .uart_config = {               \
             .port_num = UART_NUM_1,                 \
             .data_bits = UART_DATA_8_BITS,          \
@@ -114,6 +201,7 @@ struct esp_modem_dte_config {
             .rx_buffer_size = 4096,                 \
             .tx_buffer_size = 512,                  \
             .event_queue_size = 30,                 \
+            .latency_profile = ESP_MODEM_SERIAL_LATENCY_DEFAULT, \
        },                                           \
     }
 
@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 #define ESP_MODEM_VFS_DEFAULT_UART_CONFIG(name)  {  \
         .dev_name = (name), \
         .uart = {               \
@@ -30,6 +32,7 @@
             .rx_buffer_size = 4096,                 \
             .tx_buffer_size = 512,                  \
             .event_queue_size = 0,                  \
+            .latency_profile = ESP_MODEM_SERIAL_LATENCY_DEFAULT, \
        },                                           \
 }
 
@@ -42,18 +45,22 @@ struct esp_modem_vfs_uart_creator {
 };
 
 /**
- * @brief UART init struct for VFS
+ * @brief Socket init struct for VFS
  */
 struct esp_modem_vfs_socket_creator {
-    const char *host_name;                    /*!< VFS socket: host name (or IP address) */
+    const char *host_name;                    /*!< VFS socket: host name (or IPv4/IPv6 address), "unix:<path>" for a Unix domain socket (linux only) */
     int port;                                 /*!< VFS socket: port number */
+    int rcvbuf_size;                          /*!< VFS socket: receive buffer size (SO_RCVBUF), 0 keeps the system default */
+    int sndbuf_size;                          /*!< VFS socket: send buffer size (SO_SNDBUF), 0 keeps the system default */
+    uint32_t reconnect_min_ms;                /*!< VFS socket: delay before reconnecting a lost connection, doubled after each failed attempt, 0 disables reconnecting */
+    uint32_t reconnect_max_ms;                /*!< VFS socket: maximum delay between the reconnection attempts, 0 defaults to 30000 ms */
 };
 
 /**
  * @brief Creates a socket VFS and configures the DTE struct
  *
  * @param config Socket config option, basically host + port
- * @param created_config reference to the VFS portion of the DTE config to be set up
+ * @param created_config reference to the VFS portion of the DTE config to be set up (all of its fields are overwritten)
  * @return true on success
  */
 bool vfs_create_socket(struct esp_modem_vfs_socket_creator *config, struct esp_modem_vfs_term_config *created_config);
@@ -62,7 +69,7 @@ bool vfs_create_socket(struct esp_modem_vfs_socket_creator *config, struct esp_m
  * @brief Creates a uart VFS and configures the DTE struct
  *
  * @param config Uart config option, basically file name and console options
- * @param created_config reference to the VFS portion of the DTE config to be set up
+ * @param created_config reference to the VFS portion of the DTE config to be set up (all of its fields are overwritten)
  * @return true on success
  */
 bool vfs_create_uart(struct esp_modem_vfs_uart_creator *config, struct esp_modem_vfs_term_config *created_config);
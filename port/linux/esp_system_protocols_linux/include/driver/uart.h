@@ -17,4 +17,29 @@
 typedef int uart_port_t;
 typedef int uart_word_length_t;
 typedef int uart_stop_bits_t;
-typedef int uart_parity_t;
\ No newline at end of file
+typedef int uart_parity_t;
+/* Values of the UART parameters as defined by the ESP-IDF driver, mapped to termios options by the linux uart_resource */
+enum {
+    UART_NUM_0 = 0,
+    UART_NUM_1,
+    UART_NUM_2,
+};
+
+enum {
+    UART_DATA_5_BITS = 0x0,
+    UART_DATA_6_BITS = 0x1,
+    UART_DATA_7_BITS = 0x2,
+    UART_DATA_8_BITS = 0x3,
+};
+
+enum {
+    UART_STOP_BITS_1 = 0x1,
+    UART_STOP_BITS_1_5 = 0x2,
+    UART_STOP_BITS_2 = 0x3,
+};
+
+enum {
+    UART_PARITY_DISABLE = 0x0,
+    UART_PARITY_EVEN = 0x2,
+    UART_PARITY_ODD = 0x3,
+};
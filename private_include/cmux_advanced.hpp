@@ -0,0 +1,126 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace esp_modem::cmux_advanced {
+
+/**
+ * @brief GSM 07.10 advanced option framing (HDLC-like transparency)
+ */
+constexpr uint8_t FLAG = 0x7E;          /*!< Opening/closing flag of the frame */
+constexpr uint8_t ESCAPE = 0x7D;        /*!< Control escape, the following byte is XORed with ESCAPE_MASK */
+constexpr uint8_t ESCAPE_MASK = 0x20;
+
+/**
+ * @brief Finds the first byte which needs to be escaped (or is a control octet in the received data)
+ *
+ * Scans 32 or 16 bytes per step if the target supports AVX2, SSE2 or NEON, one machine word per step otherwise
+ * @return Offset of the first FLAG or ESCAPE byte, or len if there's none
+ */
+inline size_t find_special(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i flag32 = _mm256_set1_epi8(FLAG);
+    const __m256i escape32 = _mm256_set1_epi8(ESCAPE);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, flag32), _mm256_cmpeq_epi8(v, escape32)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    const __m128i flag16 = _mm_set1_epi8(FLAG);
+    const __m128i escape16 = _mm_set1_epi8(ESCAPE);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, flag16), _mm_cmpeq_epi8(v, escape16)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t flag16 = vdupq_n_u8(FLAG);
+    const uint8x16_t escape16 = vdupq_n_u8(ESCAPE);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        uint8x16_t match = vorrq_u8(vceqq_u8(v, flag16), vceqq_u8(v, escape16));
+        // reduce to 64 bits, as vmaxvq_u8() is available on AArch64 only
+        uint8x8_t any = vorr_u8(vget_low_u8(match), vget_high_u8(match));
+        if (vget_lane_u64(vreinterpret_u64_u8(any), 0)) {
+            break;  // locate the byte below
+        }
+    }
+#else
+    // SWAR: a word contains the byte if XOR with the byte repeated produces a zero byte
+    using word_t = uintptr_t;
+    constexpr word_t ones = ~word_t(0) / 0xFF;
+    constexpr word_t highs = ones * 0x80;
+    for (; i + sizeof(word_t) <= len; i += sizeof(word_t)) {
+        word_t w;
+        memcpy(&w, data + i, sizeof(w));
+        word_t f = w ^ (ones * FLAG);
+        word_t e = w ^ (ones * ESCAPE);
+        if (((f - ones) & ~f & highs) | ((e - ones) & ~e & highs)) {
+            break;
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (data[i] == FLAG || data[i] == ESCAPE) {
+            return i;
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief Escapes the data for transmission
+ * @param src Data to escape
+ * @param len Length of the data
+ * @param dst Output buffer, which has to be able to hold 2 * len bytes
+ * @return Length of the escaped data
+ */
+inline size_t escape(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t out = 0;
+    while (len > 0) {
+        size_t run = find_special(src, len);
+        memcpy(dst + out, src, run);
+        out += run;
+        src += run;
+        len -= run;
+        if (len > 0) {
+            dst[out++] = ESCAPE;
+            dst[out++] = *src++ ^ ESCAPE_MASK;
+            len--;
+        }
+    }
+    return out;
+}
+
+} // namespace esp_modem::cmux_advanced
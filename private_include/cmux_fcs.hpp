@@ -0,0 +1,79 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esp_modem::cmux_fcs {
+
+/**
+ * @brief GSM 07.10 frame check sequence (reversed CRC-8, polynomial x^8 + x^2 + x + 1)
+ */
+constexpr uint8_t INIT_VALUE = 0xFF;    /*!< Initial value of the FCS accumulator */
+constexpr uint8_t GOOD_VALUE = 0xCF;    /*!< Accumulator value after processing a valid frame including its FCS */
+constexpr uint8_t POLYNOMIAL = 0xE0;    /*!< Reversed generator polynomial */
+
+/**
+ * @brief Generates the byte-wise lookup table in compile time
+ */
+constexpr std::array<uint8_t, 256> make_table()
+{
+    std::array<uint8_t, 256> table{};
+    for (int i = 0; i < 256; ++i) {
+        uint8_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ POLYNOMIAL : (crc >> 1);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, 256> table = make_table();
+
+/**
+ * @brief Updates the running FCS accumulator with the supplied bytes
+ * @param crc Current accumulator value (INIT_VALUE for a new frame)
+ * @param data Data to process
+ * @param len Length of the data
+ * @return Updated accumulator value
+ */
+constexpr uint8_t update(uint8_t crc, const uint8_t *data, size_t len)
+{
+    while (len--) {
+        crc = table[crc ^ *data++];
+    }
+    return crc;
+}
+
+/**
+ * @brief Calculates the FCS value to be transmitted for the given bytes
+ */
+constexpr uint8_t calculate(const uint8_t *data, size_t len)
+{
+    return 0xFF - update(INIT_VALUE, data, len);
+}
+
+/**
+ * @brief Checks the received FCS against the accumulated value of the frame
+ */
+constexpr bool verify(uint8_t crc, uint8_t received_fcs)
+{
+    return table[crc ^ received_fcs] == GOOD_VALUE;
+}
+
+} // namespace esp_modem::cmux_fcs
@@ -29,7 +29,15 @@ struct uart_resource {
 
     ~uart_resource();
 
+    /**
+     * @brief Changes the baud rate of the already configured UART
+     * @return true on success
+     */
+    bool set_baud_rate(int baud_rate);
+
     uart_port_t port{};
+    int fd{-1};     /*!< File descriptor of the serial device (linux only) */
+    uint32_t read_poll_ms{0};   /*!< Period of reading the data below the VMIN threshold (linux only) */
 };
 
 
@@ -0,0 +1,25 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+/**
+ * @brief Resource attached to the VFS terminal by its creator, released by the creator's deleter
+ *
+ * The specific creators (uart, socket) derive their resources from this struct
+ */
+struct esp_modem_vfs_resource {
+    virtual ~esp_modem_vfs_resource() = default;
+};
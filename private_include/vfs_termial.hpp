@@ -15,11 +15,41 @@
 #pragma once
 
 #include "cxx_include/esp_modem_dte.hpp"
+#include "esp_modem_config.h"
 
 struct esp_modem_dte_config;
 
 namespace esp_modem {
 
+/**
+ * @brief File descriptor of the VFS terminal, closed by the configured deleter
+ */
+struct File {
+    explicit File(const esp_modem_dte_config *config):
+        fd(config->vfs_config.fd), deleter(config->vfs_config.deleter), resource(config->vfs_config.resource),
+        set_baud_rate(config->vfs_config.set_baud_rate), reconnect(config->vfs_config.reconnect)
+    {}
+
+    ~File()
+    {
+        if (deleter) {
+            deleter(fd, resource);
+        }
+    }
+    int fd;
+    void (*deleter)(int fd, struct esp_modem_vfs_resource *res);
+    struct esp_modem_vfs_resource *resource;
+    bool (*set_baud_rate)(int fd, struct esp_modem_vfs_resource *res, int baud_rate);
+    int (*reconnect)(struct esp_modem_vfs_resource *res);
+};
+
 std::unique_ptr<Terminal> create_vfs_terminal(const esp_modem_dte_config *config);
 
+#if defined(CONFIG_IDF_TARGET_LINUX)
+/**
+ * @brief Creates the io_uring based terminal (selected by ESP_MODEM_VFS_IO_URING)
+ */
+std::unique_ptr<Terminal> create_uring_terminal(const esp_modem_dte_config *config);
+#endif
+
 }  // namespace esp_modem
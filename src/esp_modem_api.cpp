@@ -21,6 +21,9 @@
 #include "cxx_include/esp_modem_dce_factory.hpp"
 #include "esp_modem_config.h"
 #include "exception_stub.hpp"
+#if defined(CONFIG_IDF_TARGET_LINUX)
+#include "cxx_include/esp_modem_recorder.hpp"
+#endif
 
 namespace esp_modem {
 
@@ -30,10 +33,20 @@ struct PdpContext;
 static const char *TAG = "modem_api";
 #endif
 
+static std::unique_ptr<Terminal> record_terminal(const dte_config *config, std::unique_ptr<Terminal> term)
+{
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (term && config->record_path) {
+        return std::make_unique<RecordingTerminal>(std::move(term), config->record_path);
+    }
+#endif
+    return term;
+}
+
 std::shared_ptr<DTE> create_uart_dte(const dte_config *config)
 {
     TRY_CATCH_RET_NULL(
-        auto term = create_uart_terminal(config);
+        auto term = record_terminal(config, create_uart_terminal(config));
         return std::make_shared<DTE>(config, std::move(term));
     )
 }
@@ -41,7 +54,7 @@ std::shared_ptr<DTE> create_uart_dte(const dte_config *config)
 std::shared_ptr<DTE> create_vfs_dte(const dte_config *config)
 {
     TRY_CATCH_RET_NULL(
-        auto term = create_vfs_terminal(config);
+        auto term = record_terminal(config, create_vfs_terminal(config));
         return std::make_shared<DTE>(config, std::move(term));
     )
 }
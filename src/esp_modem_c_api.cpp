@@ -42,6 +42,8 @@ static inline esp_err_t command_response_to_esp_err(command_result res)
         return ESP_FAIL;
     case command_result::TIMEOUT:
         return ESP_ERR_TIMEOUT;
+    case command_result::BUFFER_OVERFLOW:
+        return ESP_ERR_NO_MEM;
     }
     return ESP_ERR_INVALID_ARG;
 }
@@ -13,20 +13,15 @@
 // limitations under the License.
 
 #include <cstring>
-#include <unistd.h>
+#include <chrono>
 #include <cxx_include/esp_modem_cmux.hpp>
 #include "cxx_include/esp_modem_dte.hpp"
 #include "esp_log.h"
+#include "cmux_fcs.hpp"
+#include "cmux_advanced.hpp"
 
 using namespace esp_modem;
 
-/**
- * @brief Define this to defragment partially received data of CMUX payload
- *        This is useful if upper layers expect the entire payload available
- *        for parsing.
- */
-#define DEFRAGMENT_CMUX_PAYLOAD
-
 #define EA 0x01  /* Extension bit      */
 #define CR 0x02  /* Command / Response */
 #define PF 0x10  /* Poll / Final       */
@@ -55,39 +50,315 @@ using namespace esp_modem;
 #define CMD_SNC    0x68  /* Service Negotiation Command              */
 #define CMD_MSC    0x70  /* Modem Status Command                     */
 
+/* V.24 signals of Modem Status Command */
+#define MSC_FC     0x02  /* Flow Control (unable to accept frames)   */
+#define MSC_RTC    0x04  /* Ready To Communicate                     */
+#define MSC_RTR    0x08  /* Ready To Receive                         */
+#define MSC_DV     0x80  /* Data Valid                               */
+
 /* Flag sequence field between messages (start of frame) */
 #define SOF_MARKER 0xF9
 
-uint8_t CMux::fcs_crc(const uint8_t frame[6])
+/* Frame size limits (N1) */
+constexpr size_t BASIC_FRAME_SIZE = 127;        /* Maximum size encoded in one-byte length field */
+constexpr size_t MAX_FRAME_SIZE = 32767;        /* Maximum size encoded in two-byte (extended) length field */
+constexpr size_t FOOTER_SIZE = 2;               /* FCS + closing SOF */
+
+/* Virtual terminals opened by default (command and data) */
+constexpr size_t DEFAULT_TERMINALS_NUM = 2;
+
+/* Event signalling: one bit per DLCI handshake (shared by higher DLCIs), PN response, resumed flow, test response,
+   stopping the keep-alive task and a writer giving up */
+constexpr size_t SIGNAL_DLCI_BITS = 20;
+constexpr uint32_t SIGNAL_PN = 1 << 20;
+constexpr uint32_t SIGNAL_FLOW = 1 << 21;
+constexpr uint32_t SIGNAL_TEST = 1 << 22;
+constexpr uint32_t SIGNAL_KEEPALIVE_STOP = 1 << 23;
+constexpr uint32_t SIGNAL_TX_GIVEN_UP = 1 << 24;
+constexpr uint32_t SHARED_SIGNAL_SLICE_MS = 10;     /* Re-check period of DLCIs sharing the event bit */
+constexpr uint32_t FLOW_RECHECK_MS = 10;            /* Re-check period of writers stopped by flow control */
+constexpr uint32_t DEFAULT_CONNECT_TIMEOUT_MS = 1000;
+
+/* Keep-alive defaults */
+constexpr uint32_t DEFAULT_KEEPALIVE_TIMEOUT_MS = 1000;
+constexpr uint32_t DEFAULT_KEEPALIVE_MAX_MISSES = 3;
+constexpr size_t KEEPALIVE_TASK_STACK_SIZE = 3072;
+constexpr size_t KEEPALIVE_TASK_PRIORITY = 5;
+
+static uint32_t dlci_signal(size_t i)
 {
-    //    #define FCS_GOOD_VALUE 0xCF
-    uint8_t crc = 0xFF; // FCS_INIT_VALUE
+    return 1 << (i % SIGNAL_DLCI_BITS);
+}
 
-    for (int i = 1; i < 4; i++) {
-        crc ^= frame[i];
+/* Bytes sent from one DLC before re-scheduling if other DLCs have data waiting */
+constexpr size_t TX_QUANTUM = 512;
 
-        for (int j = 0; j < 8; j++) {
-            if (crc & 0x01) {
-                crc = (crc >> 1) ^ 0xe0; // FCS_POLYNOMIAL
-            } else {
-                crc >>= 1;
-            }
+CMux::CMux(std::unique_ptr<Terminal> t, std::unique_ptr<uint8_t[]> b, size_t buff_size, const esp_modem_cmux_config *config):
+    term(std::move(t)), pn_ack(-1), ua_received(0), dm_received(0), connect_timeout_ms(DEFAULT_CONNECT_TIMEOUT_MS), connect_retries(0),
+    keepalive_interval_ms(0), keepalive_timeout_ms(DEFAULT_KEEPALIVE_TIMEOUT_MS), keepalive_max_misses(DEFAULT_KEEPALIVE_MAX_MISSES),
+    test_received(0), keepalive_state(), fcs_errors(0), rx_dropping(false), rx_overflows(0),
+    max_frame_size(BASIC_FRAME_SIZE), buffer_size(buff_size), buffer(std::move(b))
+{
+    size_t terminals_num = DEFAULT_TERMINALS_NUM;
+    if (config && config->max_frame_size > BASIC_FRAME_SIZE) {
+        max_frame_size = std::min(config->max_frame_size, MAX_FRAME_SIZE);
+    }
+    if (config && config->terminals_num > DEFAULT_TERMINALS_NUM) {
+        terminals_num = std::min(config->terminals_num, MAX_TERMINALS_NUM);
+    }
+    // each ring must hold at least one complete frame
+    rx_buffer_size = 2 * max_frame_size;
+    if (config && config->rx_buffer_size > 0) {
+        rx_buffer_size = std::max(config->rx_buffer_size, max_frame_size);
+    }
+    if (config && config->connect_timeout_ms > 0) {
+        connect_timeout_ms = config->connect_timeout_ms;
+    }
+    if (config) {
+        connect_retries = config->connect_retries;
+        keepalive_interval_ms = config->keepalive_interval_ms;
+        if (config->keepalive_timeout_ms > 0) {
+            keepalive_timeout_ms = config->keepalive_timeout_ms;
         }
+        if (config->keepalive_max_misses > 0) {
+            keepalive_max_misses = config->keepalive_max_misses;
+        }
+    }
+    control_rx.allocate(max_frame_size);
+    if (config && config->option == ESP_MODEM_CMUX_ADVANCED_OPTION) {
+        // received frame without flags: address, control, information and FCS
+        advanced_frame = std::make_unique<uint8_t[]>(max_frame_size + 3);
+        // escaped frames are encoded to the TX buffer, which holds at least two frames even if all bytes are escaped
+        tx_buffer_size = 2 * (2 * (max_frame_size + 3) + 2);
+        tx_buffer = std::make_unique<uint8_t[]>(tx_buffer_size);
     }
+    dlcis.resize(terminals_num);
+    for (auto &d : dlcis) {
+        d.connect_timeout_ms = connect_timeout_ms;
+        d.connect_retries = connect_retries;
+    }
+    dlcis[0].priority = 1;  // command terminal takes precedence over data and other terminals
+}
 
-    return crc;
+CMux::~CMux()
+{
+    if (keepalive_task) {
+        signal.set(SIGNAL_KEEPALIVE_STOP);
+        keepalive_task.reset();
+    }
+    {
+        Scoped<Lock> l(state_lock);
+        tx_abort = true;
+    }
+    signal.set(SIGNAL_FLOW);
+    while (true) {  // the requests live on the stacks of their writers, wait until they leave
+        {
+            Scoped<Lock> l(state_lock);
+            if (tx_pending == 0) {
+                break;
+            }
+        }
+        signal.wait(SIGNAL_TX_GIVEN_UP, FLOW_RECHECK_MS);
+    }
 }
 
-void CMux::send_sabm(size_t i)
+void CMux::send_frame(size_t i, uint8_t frame_type)
 {
     uint8_t frame[6];
     frame[0] = SOF_MARKER;
     frame[1] = (i << 2) | 0x3;
-    frame[2] = FT_SABM | PF;
+    frame[2] = frame_type;
     frame[3] = 1;
-    frame[4] = 0xFF - fcs_crc(frame);
+    frame[4] = cmux_fcs::calculate(&frame[1], 3);
     frame[5] = SOF_MARKER;
-    term->write(frame, 6);
+    transmit(i, frame, sizeof(frame), true);
+}
+
+void CMux::send_control(const uint8_t *msg, size_t len)
+{
+    uint8_t frame[BASIC_FRAME_SIZE + 6];
+    if (len > BASIC_FRAME_SIZE) {
+        return;
+    }
+    frame[0] = SOF_MARKER;
+    frame[1] = 0x3;
+    frame[2] = FT_UIH;
+    frame[3] = (len << 1) | EA;
+    memcpy(&frame[4], msg, len);
+    frame[4 + len] = cmux_fcs::calculate(&frame[1], 3);
+    frame[5 + len] = SOF_MARKER;
+    transmit(0, frame, len + 6, true);
+}
+
+void CMux::send_pn(size_t i, uint8_t cr, size_t n1)
+{
+    uint8_t msg[10];
+    msg[0] = CMD_PN | cr | EA;
+    msg[1] = (8 << 1) | EA;
+    msg[2] = i;             // DLCI
+    msg[3] = 0;             // UIH frames, convergence layer type 1
+    msg[4] = i > 0 && i <= dlcis.size() ? dlcis[i - 1].priority : 0;
+    msg[5] = 10;            // T1 acknowledgement timer (in 10ms units)
+    msg[6] = n1 & 0xFF;     // N1 maximum frame size
+    msg[7] = n1 >> 8;
+    msg[8] = 3;             // N2 maximum number of retransmissions
+    msg[9] = 2;             // k window size (error recovery mode only)
+    send_control(msg, sizeof(msg));
+}
+
+void CMux::send_msc(size_t i, bool flow_off)
+{
+    uint8_t msg[4];
+    msg[0] = CMD_MSC | CR | EA;
+    msg[1] = (2 << 1) | EA;
+    msg[2] = (i << 2) | CR | EA;    // DLCI
+    msg[3] = EA | MSC_RTC | MSC_RTR | MSC_DV | (flow_off ? MSC_FC : 0);
+    send_control(msg, sizeof(msg));
+}
+
+void CMux::respond(const uint8_t *msg, size_t len)
+{
+    uint8_t response[BASIC_FRAME_SIZE];
+    len = std::min(len, sizeof(response));
+    memcpy(response, msg, len);
+    response[0] &= ~CR;
+    send_control(response, len);
+}
+
+void CMux::on_control(const uint8_t *msg, size_t len)
+{
+    if (msg == nullptr || len < 2) {
+        return;
+    }
+    uint8_t cmd = msg[0] & ~(EA | CR);
+    bool is_command = msg[0] & CR;
+    size_t value_len = msg[1] >> 1;
+    const uint8_t *value = msg + 2;
+    if (value_len > len - 2) {
+        ESP_LOGW("CMUX", "Malformed control message: cmd:%02x len:%u", cmd, static_cast<unsigned>(value_len));
+        return;
+    }
+    switch (cmd) {
+    case CMD_PN: {
+        if (value_len < 8) {
+            return;
+        }
+        size_t pn_dlci = value[0] & 0x3F;
+        size_t n1 = value[4] | (value[5] << 8);
+        if (pn_dlci == 0 || pn_dlci > dlcis.size() || n1 == 0) {
+            return;
+        }
+        n1 = std::min(n1, max_frame_size);
+        {
+            Scoped<Lock> l(state_lock);
+            dlcis[pn_dlci - 1].frame_size = n1;
+            if (!is_command) {
+                pn_ack = pn_dlci;
+            }
+        }
+        if (!is_command) {
+            signal.set(SIGNAL_PN);
+        }
+        ESP_LOGD("CMUX", "Negotiated frame size for dlci:%u is %u", static_cast<unsigned>(pn_dlci), static_cast<unsigned>(n1));
+        if (is_command) {   // the modem initiated the negotiation, answer with the accepted parameters
+            send_pn(pn_dlci, 0, n1);
+        }
+        break;
+    }
+    case CMD_NSC:
+        if (value_len > 0 && (value[0] & ~(EA | CR)) == CMD_PN) {
+            {
+                Scoped<Lock> l(state_lock);
+                pn_ack = 0;     // PN not supported by the modem, no need to wait
+            }
+            signal.set(SIGNAL_PN);
+        }
+        break;
+    case CMD_MSC: {
+        if (!is_command || value_len < 2) {
+            break;
+        }
+        size_t msc_dlci = value[0] >> 2;
+        bool flow_off = value[1] & MSC_FC;
+        if (msc_dlci > 0 && msc_dlci <= dlcis.size()) {
+            {
+                Scoped<Lock> l(state_lock);
+                dlcis[msc_dlci - 1].tx_stopped = flow_off;
+            }
+            ESP_LOGD("CMUX", "Flow %s for dlci:%u", flow_off ? "off" : "on", static_cast<unsigned>(msc_dlci));
+            if (!flow_off) {
+                signal.set(SIGNAL_FLOW);
+            }
+        }
+        respond(msg, 2 + value_len);
+        break;
+    }
+    case CMD_FCON:
+    case CMD_FCOFF:
+        if (!is_command) {
+            break;
+        }
+        {
+            Scoped<Lock> l(state_lock);
+            tx_flow_off = cmd == CMD_FCOFF;
+        }
+        if (cmd == CMD_FCON) {
+            signal.set(SIGNAL_FLOW);
+        }
+        respond(msg, 2);
+        break;
+    case CMD_TEST:
+        if (is_command) {
+            respond(msg, 2 + value_len);
+        } else if (value_len == 4) {    // response to our keep-alive
+            {
+                Scoped<Lock> l(state_lock);
+                test_received = (value[0] << 24) | (value[1] << 16) | (value[2] << 8) | value[3];
+            }
+            signal.set(SIGNAL_TEST);
+        }
+        break;
+    case CMD_RLS:
+        if (is_command) {
+            respond(msg, 2 + value_len);
+        }
+        break;
+    default:
+        ESP_LOGD("CMUX", "Unhandled control message cmd:%02x", cmd);
+        if (is_command) {
+            uint8_t nsc[3] = { CMD_NSC | EA, (1 << 1) | EA, msg[0] };
+            send_control(nsc, sizeof(nsc));
+        }
+        break;
+    }
+}
+
+bool CMux::negotiate(size_t i)
+{
+    {
+        Scoped<Lock> l(state_lock);
+        pn_ack = -1;
+    }
+    signal.clear(SIGNAL_PN);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(connect_timeout_ms);
+    send_pn(i, CR, max_frame_size);
+    while (true) {
+        {
+            Scoped<Lock> l(state_lock);
+            if (pn_ack == static_cast<int>(i)) {
+                return true;
+            } else if (pn_ack == 0) {
+                break;
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        signal.wait(SIGNAL_PN, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1);
+    }
+    ESP_LOGW("CMUX", "DLC parameter negotiation failed for dlci:%u, keeping basic frame size", static_cast<unsigned>(i));
+    return false;
 }
 
 
@@ -101,32 +372,140 @@ struct CMux::CMuxFrame {
     }
 };
 
+void CMux::RxRing::allocate(size_t size)
+{
+    data = std::make_unique<uint8_t[]>(size);
+    capacity = size;
+    head = available = pending = 0;
+}
+
+bool CMux::RxRing::append(const uint8_t *src, size_t len)
+{
+    if (available + pending + len > capacity) {
+        return false;
+    }
+    if (available + pending == 0) {
+        head = 0;   // keep frames contiguous whenever the ring is drained
+    }
+    size_t tail = (head + available + pending) % capacity;
+    size_t first = std::min(len, capacity - tail);
+    memcpy(&data[tail], src, first);
+    memcpy(&data[0], src + first, len - first);
+    pending += len;
+    return true;
+}
+
+size_t CMux::RxRing::segment(uint8_t **ptr) const
+{
+    *ptr = &data[head];
+    return std::min(available, capacity - head);
+}
+
+void CMux::RxRing::release(size_t len)
+{
+    available -= len;
+    head = available ? (head + len) % capacity : 0;
+}
+
 void CMux::data_available(uint8_t *data, size_t len)
 {
-    if (data && type == 0xFF && len > 0 && dlci > 0) {
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
-            // Post partial data (or defragment to post on CMUX footer)
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-            if (payload_start == nullptr) {
-                payload_start = data;
-                total_payload_size = 0;
+    bool information = (type & ~PF) == FT_UIH || (type & ~PF) == FT_UI;
+    if (data && len > 0 && information && dlci <= dlcis.size()) {
+        // Payloads are collected in the ring of the DLC and posted once the whole frame is verified
+        Scoped<Lock> l(state_lock);
+        RxRing &ring = dlci == 0 ? control_rx : dlcis[dlci - 1].rx;
+        if (rx_dropping || ring.capacity == 0 || (dlci > 0 && (!dlcis[dlci - 1].open || dlcis[dlci - 1].rx_discard))) {   // overflowing frame, DLC not opened or not read
+            return;
+        }
+        if (!ring.append(data, len)) {
+            ESP_LOGW("CMUX", "Receive ring of dlci:%02x is full, dropping frame", dlci);
+            ring.drop();
+            rx_dropping = true;
+            rx_overflows++;
+        }
+    } else if (data == nullptr && ((type & ~PF) == FT_UA || (type & ~PF) == FT_DM) && len == 0) { // notify the SABM/DISC command
+        {
+            Scoped<Lock> l(state_lock);
+            if ((type & ~PF) == FT_UA) {
+                ua_received |= 1ULL << dlci;
+                if (dlci > 0 && dlci <= dlcis.size() && dlcis[dlci - 1].opening) {
+                    dlcis[dlci - 1].open = true;    // the modem may send data right after UA
+                }
+            } else {
+                dm_received |= 1ULL << dlci;
             }
-            total_payload_size += len;
-#else
-            read_cb[virtual_term](data, len);
-#endif
         }
-    } else if (data == nullptr && type == 0x73 && len == 0) { // notify the initial SABM command
-        Scoped<Lock> l(lock);
-        sabm_ack = dlci;
-    } else if (data == nullptr) {
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-            read_cb[virtual_term](payload_start, total_payload_size);
-#endif
+        signal.set(dlci_signal(dlci));
+    } else if (data == nullptr && information && dlci == 0) {
+        // Control channel ring is always drained, so the message is contiguous
+        on_control(control_rx.data.get(), control_rx.pending);
+        control_rx.drop();
+    } else if (data == nullptr && information && dlci <= dlcis.size()) {
+        {
+            Scoped<Lock> l(state_lock);
+            dlcis[dlci - 1].rx.commit();
         }
+        deliver(dlci - 1);
+        update_rx_flow(dlci - 1);
+    }
+}
+
+void CMux::deliver(size_t inst)
+{
+    auto &d = dlcis[inst];
+    {
+        Scoped<Lock> l(state_lock);
+        if (d.delivering) {
+            return;     // the other thread posts the data committed meanwhile, too
+        }
+        d.delivering = true;
+    }
+    while (true) {
+        uint8_t *data;
+        size_t len = 0;
+        std::function<bool(uint8_t *data, size_t len)> cb;
+        {
+            Scoped<Lock> l(state_lock);
+            cb = d.read_cb;     // might be replaced while running
+            if (cb) {
+                len = d.rx.segment(&data);
+            }
+            if (len == 0) {
+                d.delivering = false;
+                return;
+            }
+        }
+        cb(data, len);          // posted in place, in two parts if the ring wraps around
+        Scoped<Lock> l(state_lock);
+        d.rx.release(d.rx_discard ? d.rx.available : len);  // callback removed meanwhile
+    }
+}
+
+void CMux::update_rx_flow(size_t inst)
+{
+    bool flow_off;
+    {
+        Scoped<Lock> l(state_lock);
+        auto &d = dlcis[inst];
+        size_t free = d.rx.capacity - d.rx.available - d.rx.pending;
+        if (!d.rx_stopped && d.open && !d.rx_discard && free < d.frame_size) {
+            d.rx_stopped = flow_off = true;     // another frame might not fit
+        } else if (d.rx_stopped && d.rx.available <= d.rx.capacity / 4) {
+            d.rx_stopped = flow_off = false;
+        } else {
+            return;
+        }
+    }
+    ESP_LOGD("CMUX", "Receive ring of dlci:%u %s, signalling flow %s", static_cast<unsigned>(inst + 1), flow_off ? "full" : "drained", flow_off ? "off" : "on");
+    send_msc(inst + 1, flow_off);
+}
+
+void CMux::drop_frame()
+{
+    Scoped<Lock> l(state_lock);
+    if (dlci <= dlcis.size()) {
+        RxRing &ring = dlci == 0 ? control_rx : dlcis[dlci - 1].rx;
+        ring.drop();
     }
 }
 
@@ -145,6 +524,8 @@ bool CMux::on_init(CMuxFrame &frame)
     state = cmux_state::HEADER;
     frame.advance();
     frame_header_offset = 1;
+    frame_fcs = cmux_fcs::INIT_VALUE;
+    rx_dropping = false;
     return true;
 }
 
@@ -180,18 +561,29 @@ bool CMux::on_header(CMuxFrame &frame)
         frame.advance();
         return true;
     }
-    if (frame.len + frame_header_offset < 4) {
-        memcpy(frame_header + frame_header_offset, frame.ptr, frame.len);
-        frame_header_offset += frame.len;
-        return false; // need read more
+    // Header consists of SOF, address, control and length, which is followed by
+    // another length byte if the EA bit of the first one is cleared (extended length)
+    size_t header_size = 4;
+    if (frame_header_offset >= 4 && (frame_header[3] & EA) == 0) {
+        header_size = 5;
     }
-    size_t payload_offset = std::min(frame.len, 4 - frame_header_offset);
+    size_t payload_offset = std::min(frame.len, header_size - frame_header_offset);
     memcpy(frame_header + frame_header_offset, frame.ptr, payload_offset);
+    frame_fcs = cmux_fcs::update(frame_fcs, frame.ptr, payload_offset);
     frame_header_offset += payload_offset;
+    frame.advance(payload_offset);
+    if (frame_header_offset < header_size) {
+        return false; // need read more
+    }
+    if (header_size == 4 && (frame_header[3] & EA) == 0) {
+        return true; // continue with the second length byte
+    }
     dlci = frame_header[1] >> 2;
     type = frame_header[2];
     payload_len = (frame_header[3] >> 1);
-    frame.advance(payload_offset);
+    if (header_size == 5) {
+        payload_len |= frame_header[4] << 7;
+    }
     state = cmux_state::PAYLOAD;
     return true;
 }
@@ -199,13 +591,21 @@ bool CMux::on_header(CMuxFrame &frame)
 bool CMux::on_payload(CMuxFrame &frame)
 {
     ESP_LOGD("CMUX", "Payload frame: dlci:%02x type:%02x payload:%d available:%d", dlci, type, payload_len, frame.len);
+    // UI frames protect also the information field, UIH frames only the header
+    bool payload_in_fcs = (type & ~PF) == FT_UI;
     if (frame.len < payload_len) { // payload
         state = cmux_state::PAYLOAD;
+        if (payload_in_fcs) {
+            frame_fcs = cmux_fcs::update(frame_fcs, frame.ptr, frame.len);
+        }
         data_available(frame.ptr, frame.len); // partial read
         payload_len -= frame.len;
         return false;
     } else { // complete
         if (payload_len > 0) {
+            if (payload_in_fcs) {
+                frame_fcs = cmux_fcs::update(frame_fcs, frame.ptr, payload_len);
+            }
             data_available(&frame.ptr[0], payload_len); // rest read
         }
         frame.advance((payload_len));
@@ -218,26 +618,30 @@ bool CMux::on_payload(CMuxFrame &frame)
 bool CMux::on_footer(CMuxFrame &frame)
 {
     size_t footer_offset = 0;
-    if (frame.len + frame_header_offset < 6) {
+    size_t fcs_offset = (frame_header[3] & EA) ? 4 : 5;
+    if (frame.len + frame_header_offset < fcs_offset + FOOTER_SIZE) {
         memcpy(frame_header + frame_header_offset, frame.ptr, frame.len);
         frame_header_offset += frame.len;
         return false; // need read more
     } else {
-        footer_offset = std::min(frame.len, 6 - frame_header_offset);
+        footer_offset = std::min(frame.len, fcs_offset + FOOTER_SIZE - frame_header_offset);
         memcpy(frame_header + frame_header_offset, frame.ptr, footer_offset);
-        if (frame_header[5] != SOF_MARKER) {
+        if (frame_header[fcs_offset + 1] != SOF_MARKER) {
             ESP_LOGW("CMUX", "Protocol mismatch: Missed trailing SOF, recovering...");
-            payload_start = nullptr;
-            total_payload_size = 0;
+            drop_frame();
             state = cmux_state::RECOVER;
             return true;
         }
         frame.advance(footer_offset);
         state = cmux_state::INIT;
         frame_header_offset = 0;
+        if (!cmux_fcs::verify(frame_fcs, frame_header[fcs_offset])) {
+            ESP_LOGW("CMUX", "FCS mismatch: dropping frame dlci:%02x type:%02x", dlci, type);
+            fcs_errors++;
+            drop_frame();
+            return true;
+        }
         data_available(nullptr, 0);
-        payload_start = nullptr;
-        total_payload_size = 0;
     }
     return true;
 }
@@ -245,21 +649,14 @@ bool CMux::on_footer(CMuxFrame &frame)
 bool CMux::on_cmux(uint8_t *data, size_t actual_len)
 {
     if (!data) {
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-        auto data_to_read = buffer_size - 128; // keep 128 (max CMUX payload) backup buffer)
-        if (payload_start) {
-            data = payload_start + total_payload_size;
-            data_to_read = payload_len + 2;
-        } else {
-            data = buffer.get();
-        }
-        actual_len = term->read(data, data_to_read);
-#else
         data = buffer.get();
         actual_len = term->read(data, buffer_size);
-#endif
     }
     ESP_LOG_BUFFER_HEXDUMP("CMUX Received", data, actual_len, ESP_LOG_VERBOSE);
+    if (advanced_frame) {
+        on_cmux_advanced(data, actual_len);
+        return true;
+    }
     CMuxFrame frame = { .ptr = data, .len = actual_len };
     while (frame.len > 0) {
         switch (state) {
@@ -293,6 +690,81 @@ bool CMux::on_cmux(uint8_t *data, size_t actual_len)
     return true;
 }
 
+void CMux::on_cmux_advanced(const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (advanced_escaped) {
+            if (*data == cmux_advanced::FLAG) {
+                advanced_overflow = true;   // abort sequence, drop the frame
+            } else {
+                append_advanced(data, 1, cmux_advanced::ESCAPE_MASK);
+                data++;
+                len--;
+                advanced_escaped = false;
+                continue;
+            }
+        }
+        size_t run = cmux_advanced::find_special(data, len);
+        append_advanced(data, run, 0);
+        data += run;
+        len -= run;
+        if (len == 0) {
+            break;
+        }
+        if (*data == cmux_advanced::ESCAPE) {
+            advanced_escaped = true;
+        } else {    // flag closes the current frame and opens the next one
+            if (advanced_overflow) {
+                ESP_LOGW("CMUX", "Dropping aborted or oversized frame");
+            } else if (advanced_frame_len >= 3) {
+                on_advanced_frame();
+            }
+            advanced_frame_len = 0;
+            advanced_escaped = advanced_overflow = false;
+        }
+        data++;
+        len--;
+    }
+}
+
+void CMux::append_advanced(const uint8_t *data, size_t len, uint8_t mask)
+{
+    if (advanced_overflow) {
+        return;
+    }
+    if (advanced_frame_len + len > max_frame_size + 3) {
+        advanced_overflow = true;
+        return;
+    }
+    memcpy(&advanced_frame[advanced_frame_len], data, len);
+    if (mask) {
+        advanced_frame[advanced_frame_len] ^= mask;
+    }
+    advanced_frame_len += len;
+}
+
+void CMux::on_advanced_frame()
+{
+    uint8_t *frame = advanced_frame.get();
+    size_t info_len = advanced_frame_len - 3;
+    uint8_t fcs = cmux_fcs::update(cmux_fcs::INIT_VALUE, frame, 2);
+    if ((frame[1] & ~PF) == FT_UI) {
+        fcs = cmux_fcs::update(fcs, frame + 2, info_len);
+    }
+    if (!cmux_fcs::verify(fcs, frame[advanced_frame_len - 1])) {
+        ESP_LOGW("CMUX", "FCS mismatch: dropping frame dlci:%02x type:%02x", frame[0] >> 2, frame[1]);
+        fcs_errors++;
+        return;
+    }
+    dlci = frame[0] >> 2;
+    type = frame[1];
+    rx_dropping = false;
+    if (info_len > 0) {
+        data_available(frame + 2, info_len);
+    }
+    data_available(nullptr, 0);
+}
+
 bool CMux::init()
 {
     frame_header_offset = 0;
@@ -301,60 +773,558 @@ bool CMux::init()
         this->on_cmux(data, len);
         return false;
     });
+    // Control channel and default terminals are requested back to back, unless their parameters
+    // need to be negotiated over the control channel first
+    size_t list[DEFAULT_TERMINALS_NUM + 1] = { 0 };
+    for (size_t i = 0; i < DEFAULT_TERMINALS_NUM; i++) {
+        prepare_terminal(i);
+        list[i + 1] = i + 1;
+    }
+    size_t start = 0;
+    if (max_frame_size > BASIC_FRAME_SIZE) {
+        if (!connect(list, 1, FT_SABM | PF)) {
+            return false;
+        }
+        for (size_t i = 1; i <= DEFAULT_TERMINALS_NUM; i++) {
+            negotiate(i);   // falls back to the basic frame size on failure
+        }
+        start = 1;
+    }
+    if (!connect(list + start, DEFAULT_TERMINALS_NUM + 1 - start, FT_SABM | PF)) {
+        ESP_LOGE("CMUX", "Failed to open the default terminals");
+        return false;
+    }
+    {
+        Scoped<Lock> l(state_lock);
+        for (size_t i = 0; i < DEFAULT_TERMINALS_NUM; i++) {
+            dlcis[i].open = true;
+            dlcis[i].opening = false;
+        }
+    }
+    if (keepalive_interval_ms > 0 && !keepalive_task) {
+        signal.clear(SIGNAL_KEEPALIVE_STOP);
+        keepalive_task = std::make_unique<Task>(KEEPALIVE_TASK_STACK_SIZE, KEEPALIVE_TASK_PRIORITY, this, [](void *p) {
+            static_cast<CMux *>(p)->keepalive();
+            Task::Delete();
+        });
+    }
+    return true;
+}
 
-    sabm_ack = -1;
-    for (size_t i = 0; i < 3; i++) {
-        int timeout = 0;
-        send_sabm(i);
-        while (true) {
-            usleep(10'000);
-            Scoped<Lock> l(lock);
-            if (sabm_ack == i) {
-                sabm_ack = -1;
-                break;
+bool CMux::send_test(uint32_t seq)
+{
+    uint8_t msg[6] = { CMD_TEST | CR | EA, (4 << 1) | EA,
+                       static_cast<uint8_t>(seq >> 24), static_cast<uint8_t>(seq >> 16), static_cast<uint8_t>(seq >> 8), static_cast<uint8_t>(seq)
+                     };
+    signal.clear(SIGNAL_TEST);
+    auto sent = std::chrono::steady_clock::now();
+    auto deadline = sent + std::chrono::milliseconds(keepalive_timeout_ms);
+    send_control(msg, sizeof(msg));
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        {
+            Scoped<Lock> l(state_lock);
+            if (test_received == seq) {
+                uint32_t rtt_us = std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count();
+                size_t bucket = 0;
+                while (bucket < CMUX_RTT_HISTOGRAM_SIZE - 1 && rtt_us >= (1000U << bucket)) {
+                    bucket++;
+                }
+                keepalive_state.received++;
+                keepalive_state.last_rtt_us = rtt_us;
+                keepalive_state.max_rtt_us = std::max(keepalive_state.max_rtt_us, rtt_us);
+                keepalive_state.rtt_histogram[bucket]++;
+                return true;
             }
-            if (timeout++ > 100) {
-                return false;
+        }
+        if (now >= deadline || signal.is_any(SIGNAL_KEEPALIVE_STOP)) {
+            return false;
+        }
+        signal.wait_any(SIGNAL_TEST | SIGNAL_KEEPALIVE_STOP, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1);
+        signal.clear(SIGNAL_TEST);
+    }
+}
+
+void CMux::keepalive()
+{
+    uint32_t seq = 0;
+    uint32_t misses = 0;
+    while (!signal.wait_any(SIGNAL_KEEPALIVE_STOP, keepalive_interval_ms)) {
+        {
+            Scoped<Lock> l(state_lock);
+            keepalive_state.sent++;
+        }
+        if (send_test(++seq)) {
+            if (misses >= keepalive_max_misses) {
+                Scoped<Lock> l(state_lock);
+                tx_abort = false;   // the link is up again
+            }
+            misses = 0;
+            continue;
+        }
+        if (signal.is_any(SIGNAL_KEEPALIVE_STOP)) {
+            break;
+        }
+        std::function<void()> cb;
+        {
+            Scoped<Lock> l(state_lock);
+            keepalive_state.lost++;
+            if (++misses == keepalive_max_misses) {
+                cb = link_down_cb;
+                tx_abort = true;
+            }
+        }
+        if (misses == keepalive_max_misses) {
+            ESP_LOGE("CMUX", "Link down, %d keep-alive responses missed", misses);
+            signal.set(SIGNAL_FLOW);    // the writers stopped by flow control give up
+            if (cb) {
+                cb();
             }
         }
     }
-    return true;
 }
 
-int CMux::write(int virtual_term, uint8_t *data, size_t len)
+int CMux::wait_for_ack(size_t i, std::chrono::steady_clock::time_point deadline)
 {
-    const size_t cmux_max_len = 127;
-    Scoped<Lock> l(lock);
-    int i = virtual_term + 1;
-    size_t need_write = len;
-    while (need_write > 0) {
-        size_t batch_len = need_write;
-        if (batch_len > cmux_max_len) {
-            batch_len = cmux_max_len;
-        }
-        uint8_t frame[6];
+    // DLCIs sharing the event bit with another one could miss the wake-up, so they re-check periodically
+    bool shared = dlcis.size() >= SIGNAL_DLCI_BITS;
+    while (true) {
+        {
+            Scoped<Lock> l(state_lock);
+            if (ua_received & (1ULL << i)) {
+                return 1;
+            } else if (dm_received & (1ULL << i)) {
+                return -1;
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return 0;
+        }
+        uint32_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        signal.wait(dlci_signal(i), shared ? std::min(remaining, SHARED_SIGNAL_SLICE_MS) : remaining);
+    }
+}
+
+bool CMux::connect(const size_t *list, size_t count, uint8_t frame_type)
+{
+    struct Attempt {
+        size_t i;
+        uint32_t timeout_ms;
+        uint32_t retries;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::vector<Attempt> attempts(count);
+    {
+        Scoped<Lock> l(state_lock);
+        for (size_t n = 0; n < count; ++n) {
+            size_t i = list[n];
+            attempts[n].i = i;
+            attempts[n].timeout_ms = i == 0 ? connect_timeout_ms : dlcis[i - 1].connect_timeout_ms;
+            attempts[n].retries = i == 0 ? connect_retries : dlcis[i - 1].connect_retries;
+            ua_received &= ~(1ULL << i);
+            dm_received &= ~(1ULL << i);
+        }
+    }
+    for (auto &a : attempts) {
+        signal.clear(dlci_signal(a.i));
+        a.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(a.timeout_ms);
+        send_frame(a.i, frame_type);
+    }
+    bool ret = true;
+    for (auto &a : attempts) {
+        int result;
+        while ((result = wait_for_ack(a.i, a.deadline)) == 0 && a.retries > 0) {
+            ESP_LOGW("CMUX", "No response from dlci:%u, retrying", static_cast<unsigned>(a.i));
+            a.retries--;
+            a.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(a.timeout_ms);
+            send_frame(a.i, frame_type);
+        }
+        if (result != 1) {
+            ESP_LOGE("CMUX", "dlci:%u %s", static_cast<unsigned>(a.i), result < 0 ? "rejected by the modem" : "timed out");
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+void CMux::prepare_terminal(size_t inst)
+{
+    Scoped<Lock> l(state_lock);
+    dlcis[inst].frame_size = BASIC_FRAME_SIZE;
+    dlcis[inst].tx_stopped = dlcis[inst].rx_stopped = false;
+    dlcis[inst].rx_discard = false;
+    dlcis[inst].opening = true;
+    if (dlcis[inst].rx.capacity == 0) {
+        dlcis[inst].rx.allocate(rx_buffer_size);
+    }
+}
+
+bool CMux::open_terminal(int inst)
+{
+    if (inst < 0 || inst >= static_cast<int>(dlcis.size())) {
+        return false;
+    }
+    prepare_terminal(inst);
+    if (max_frame_size > BASIC_FRAME_SIZE) {
+        negotiate(inst + 1);   // falls back to the basic frame size on failure
+    }
+    size_t i = inst + 1;
+    bool ret = connect(&i, 1, FT_SABM | PF);
+    {
+        Scoped<Lock> l(state_lock);
+        dlcis[inst].open = ret;
+        dlcis[inst].opening = false;
+    }
+    if (!ret) {
+        ESP_LOGE("CMUX", "Failed to open dlci:%u", static_cast<unsigned>(i));
+    }
+    return ret;
+}
+
+bool CMux::close_terminal(int inst)
+{
+    if (inst < 0 || inst >= static_cast<int>(dlcis.size())) {
+        return false;
+    }
+    {
+        // the same as removing the read callback, the data received from now on are dropped
+        Scoped<Lock> l(state_lock);
+        auto &d = dlcis[inst];
+        d.open = d.opening = false;
+        d.read_cb = nullptr;
+        d.rx_discard = true;
+        d.rx.drop();    // the partially received frame
+        if (!d.delivering) {
+            d.rx.release(d.rx.available);
+        }
+    }
+    signal.set(SIGNAL_FLOW);    // the writers stopped by flow control give up
+    size_t i = inst + 1;
+    return connect(&i, 1, FT_DISC | PF);
+}
+
+struct CMux::TxRequest {
+    uint8_t *data;                  /*!< Data to send (complete frame if raw) */
+    size_t len;                     /*!< Remaining length of the data */
+    bool raw;                       /*!< Data is a complete frame to be sent as is */
+    bool started;                   /*!< Scheduled at least once */
+    bool done;                      /*!< All data passed to the terminal */
+    std::chrono::steady_clock::time_point enqueued;
+    TxRequest *next;
+};
+
+CMux::TxRequest *CMux::schedule(size_t &i)
+{
+    if (control_queue.head) {
+        i = 0;
+        return control_queue.head;
+    }
+    TxRequest *next = nullptr;
+    uint8_t priority = UINT8_MAX;
+    if (tx_flow_off) {
+        return nullptr;
+    }
+    for (size_t inst = 0; inst < dlcis.size(); ++inst) {
+        if (dlcis[inst].tx_queue.head && !dlcis[inst].tx_stopped && dlcis[inst].priority < priority) {
+            next = dlcis[inst].tx_queue.head;
+            priority = dlcis[inst].priority;
+            i = inst + 1;
+        }
+    }
+    return next;
+}
+
+size_t CMux::encode_advanced(uint8_t *dst, uint8_t address, uint8_t control, const uint8_t *info, size_t len)
+{
+    uint8_t header[2] = { address, control };
+    uint8_t fcs = cmux_fcs::update(cmux_fcs::INIT_VALUE, header, sizeof(header));
+    if ((control & ~PF) == FT_UI) {
+        fcs = cmux_fcs::update(fcs, info, len);
+    }
+    fcs = 0xFF - fcs;
+    size_t out = 0;
+    dst[out++] = cmux_advanced::FLAG;
+    out += cmux_advanced::escape(header, sizeof(header), dst + out);
+    out += cmux_advanced::escape(info, len, dst + out);
+    out += cmux_advanced::escape(&fcs, 1, dst + out);
+    dst[out++] = cmux_advanced::FLAG;
+    return out;
+}
+
+void CMux::send_frames_advanced(TxRequest *req, size_t i, size_t frame_size, size_t quantum)
+{
+    size_t out = 0;
+    if (req->raw) {
+        // complete basic frames (SABM, DISC, control messages) are re-encoded, without the length field
+        size_t header_size = (req->data[3] & EA) ? 4 : 5;
+        out = encode_advanced(tx_buffer.get(), req->data[1], req->data[2], req->data + header_size, req->len - header_size - FOOTER_SIZE);
+        req->len = 0;
+    }
+    size_t sent = 0;
+    while (req->len > 0 && sent < quantum) {
+        size_t batch_len = std::min(req->len, frame_size);
+        if (out + 2 * (batch_len + 3) + 2 > tx_buffer_size) {
+            break;
+        }
+        out += encode_advanced(tx_buffer.get() + out, (i << 2) + 1, FT_UIH, req->data, batch_len);
+        req->len -= batch_len;
+        req->data += batch_len;
+        sent += batch_len;
+    }
+    ESP_LOG_BUFFER_HEXDUMP("Send", tx_buffer.get(), out, ESP_LOG_VERBOSE);
+    term->write(tx_buffer.get(), out);
+}
+
+void CMux::send_frames(TxRequest *req, size_t i, size_t frame_size, size_t quantum)
+{
+    if (advanced_frame) {
+        send_frames_advanced(req, i, frame_size, quantum);
+        return;
+    }
+    const size_t max_frames = 24;   // frames gathered into one terminal write (covers an escaped PPP packet of 1500 bytes)
+    if (req->raw) {
+        struct iovec iov = { .iov_base = req->data, .iov_len = req->len };
+        ESP_LOG_BUFFER_HEXDUMP("Send", req->data, req->len, ESP_LOG_VERBOSE);
+        term->writev(&iov, 1);
+        req->len = 0;
+        return;
+    }
+    uint8_t frames[max_frames][7];
+    struct iovec iov[max_frames * 3];
+    size_t frame_num = 0;
+    size_t sent = 0;
+    while (req->len > 0 && frame_num < max_frames && sent < quantum) {
+        size_t batch_len = std::min(req->len, frame_size);
+        uint8_t *frame = frames[frame_num];
+        size_t header_size = 4;
         frame[0] = SOF_MARKER;
         frame[1] = (i << 2) + 1;
         frame[2] = FT_UIH;
-        frame[3] = (batch_len << 1) + 1;
-        frame[4] = 0xFF - fcs_crc(frame);
-        frame[5] = SOF_MARKER;
+        if (batch_len > BASIC_FRAME_SIZE) {
+            frame[3] = batch_len << 1;  // EA=0: length continues in the next byte
+            frame[4] = batch_len >> 7;
+            header_size = 5;
+        } else {
+            frame[3] = (batch_len << 1) + 1;
+        }
+        frame[header_size] = cmux_fcs::calculate(&frame[1], header_size - 1);
+        frame[header_size + 1] = SOF_MARKER;
 
-        term->write(frame, 4);
-        term->write(data, batch_len);
-        term->write(frame + 4, 2);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame, 4, ESP_LOG_VERBOSE);
-        ESP_LOG_BUFFER_HEXDUMP("Send", data, batch_len, ESP_LOG_VERBOSE);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame + 4, 2, ESP_LOG_VERBOSE);
-        need_write -= batch_len;
-        data += batch_len;
+        iov[frame_num * 3] = { .iov_base = frame, .iov_len = header_size };
+        iov[frame_num * 3 + 1] = { .iov_base = req->data, .iov_len = batch_len };
+        iov[frame_num * 3 + 2] = { .iov_base = frame + header_size, .iov_len = FOOTER_SIZE };
+        ESP_LOG_BUFFER_HEXDUMP("Send", frame, header_size, ESP_LOG_VERBOSE);
+        ESP_LOG_BUFFER_HEXDUMP("Send", req->data, batch_len, ESP_LOG_VERBOSE);
+        ESP_LOG_BUFFER_HEXDUMP("Send", frame + header_size, FOOTER_SIZE, ESP_LOG_VERBOSE);
+        req->len -= batch_len;
+        req->data += batch_len;
+        sent += batch_len;
+        frame_num++;
     }
-    return len;
+    term->writev(iov, frame_num * 3);
+}
+
+int CMux::transmit(size_t i, uint8_t *data, size_t len, bool raw)
+{
+    TxRequest req = { .data = data, .len = len, .raw = raw, .started = false, .done = false,
+                      .enqueued = std::chrono::steady_clock::now(), .next = nullptr
+                    };
+    {
+        Scoped<Lock> s(state_lock);
+        if (!raw && (i == 0 || i > dlcis.size() || !dlcis[i - 1].open)) {
+            return 0;
+        }
+        // complete frames (control messages, SABM, DISC) take precedence over the data
+        TxQueue &queue = raw ? control_queue : dlcis[i - 1].tx_queue;
+        if (queue.tail) {
+            queue.tail->next = &req;
+        } else {
+            queue.head = &req;
+        }
+        queue.tail = &req;
+        tx_pending++;
+    }
+    // Whoever owns the terminal sends the pending frames of all DLCs, ordered by their priorities,
+    // until its own request completes; so the waiting writers might find their data already sent
+    while (true) {
+        signal.clear(SIGNAL_FLOW);
+        if (send_pending(req)) {
+            return static_cast<int>(len);
+        }
+        if (!raw && give_up(i, req)) {
+            signal.set(SIGNAL_TX_GIVEN_UP);
+            return -1;
+        }
+        // all pending data stopped by flow control, release the terminal and wait for the modem to resume
+        signal.wait(SIGNAL_FLOW, FLOW_RECHECK_MS);
+    }
+}
+
+bool CMux::give_up(size_t i, TxRequest &req)
+{
+    Scoped<Lock> l(lock);   // nobody is sending the request meanwhile
+    Scoped<Lock> s(state_lock);
+    if (req.done || (dlcis[i - 1].open && !tx_abort)) {
+        return false;
+    }
+    TxQueue &queue = dlcis[i - 1].tx_queue;
+    TxRequest *prev = nullptr;
+    for (auto r = queue.head; r != &req; r = r->next) {
+        prev = r;
+    }
+    (prev ? prev->next : queue.head) = req.next;
+    if (queue.tail == &req) {
+        queue.tail = prev;
+    }
+    tx_pending--;
+    ESP_LOGW("CMUX", "Giving up writing to dlci:%u, %u bytes not sent", static_cast<unsigned>(i), static_cast<unsigned>(req.len));
+    return true;
+}
+
+bool CMux::send_pending(TxRequest &req)
+{
+    Scoped<Lock> l(lock);
+    while (true) {
+        TxRequest *next;
+        size_t next_dlci = 0;
+        size_t frame_size = BASIC_FRAME_SIZE;
+        size_t quantum = SIZE_MAX;
+        {
+            Scoped<Lock> s(state_lock);
+            if (req.done) {
+                return true;
+            }
+            next = schedule(next_dlci);
+            if (next == nullptr) {
+                return false;
+            }
+            if (next_dlci > 0) {
+                auto &dlci_state = dlcis[next_dlci - 1];
+                frame_size = dlci_state.frame_size;
+                if (!next->started) {
+                    auto delay = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - next->enqueued).count();
+                    dlci_state.tx_stats.requests++;
+                    dlci_state.tx_stats.total_delay_us += delay;
+                    dlci_state.tx_stats.max_delay_us = std::max<uint32_t>(dlci_state.tx_stats.max_delay_us, delay);
+                }
+            }
+            next->started = true;
+            if (tx_pending > 1) {
+                quantum = TX_QUANTUM;   // others are waiting, give them a chance after this round
+            }
+        }
+        send_frames(next, next_dlci, frame_size, quantum);
+        if (next->len == 0) {
+            Scoped<Lock> s(state_lock);
+            TxQueue &queue = next->raw ? control_queue : dlcis[next_dlci - 1].tx_queue;
+            queue.head = next->next;
+            if (queue.head == nullptr) {
+                queue.tail = nullptr;
+            }
+            tx_pending--;
+            next->done = true;
+        }
+    }
+}
+
+int CMux::write(int virtual_term, uint8_t *data, size_t len)
+{
+    if (virtual_term < 0) {
+        return 0;
+    }
+    return transmit(virtual_term + 1, data, len, false);
+}
+
+int CMux::read(int inst, uint8_t *data, size_t len)
+{
+    if (inst < 0 || inst >= static_cast<int>(dlcis.size())) {
+        return 0;
+    }
+    size_t read_len = 0;
+    {
+        Scoped<Lock> l(state_lock);
+        dlcis[inst].rx_discard = false;
+        auto &ring = dlcis[inst].rx;
+        while (read_len < len) {
+            uint8_t *segment;
+            size_t segment_len = std::min(ring.segment(&segment), len - read_len);
+            if (segment_len == 0) {
+                break;
+            }
+            memcpy(data + read_len, segment, segment_len);
+            ring.release(segment_len);
+            read_len += segment_len;
+        }
+    }
+    update_rx_flow(inst);
+    return read_len;
+}
+
+void CMux::set_connect_policy(int inst, uint32_t timeout_ms, uint32_t retries)
+{
+    if (inst >= 0 && inst < static_cast<int>(dlcis.size())) {
+        Scoped<Lock> l(state_lock);
+        dlcis[inst].connect_timeout_ms = timeout_ms > 0 ? timeout_ms : connect_timeout_ms;
+        dlcis[inst].connect_retries = retries;
+    }
+}
+
+bool CMux::tx_stopped(int inst)
+{
+    Scoped<Lock> l(state_lock);
+    if (inst >= 0 && inst < static_cast<int>(dlcis.size())) {
+        return tx_flow_off || dlcis[inst].tx_stopped;
+    }
+    return false;
+}
+
+void CMux::set_link_down_cb(std::function<void()> f)
+{
+    Scoped<Lock> l(state_lock);
+    link_down_cb = std::move(f);
+}
+
+cmux_keepalive_stats CMux::keepalive_stats()
+{
+    Scoped<Lock> l(state_lock);
+    return keepalive_state;
+}
+
+void CMux::set_priority(int inst, uint8_t priority)
+{
+    if (inst >= 0 && inst < static_cast<int>(dlcis.size())) {
+        Scoped<Lock> l(state_lock);
+        dlcis[inst].priority = priority;
+    }
+}
+
+cmux_tx_stats CMux::tx_stats(int inst)
+{
+    Scoped<Lock> l(state_lock);
+    if (inst >= 0 && inst < static_cast<int>(dlcis.size())) {
+        return dlcis[inst].tx_stats;
+    }
+    return {};
 }
 
 void CMux::set_read_cb(int inst, std::function<bool(uint8_t *, size_t)> f)
 {
-    if (inst < MAX_TERMINALS_NUM) {
-        read_cb[inst] = std::move(f);
+    if (inst < 0 || inst >= static_cast<int>(dlcis.size())) {
+        return;
+    }
+    auto &d = dlcis[inst];
+    bool reader = f != nullptr;
+    {
+        Scoped<Lock> l(state_lock);
+        d.read_cb = std::move(f);
+        d.rx_discard = !reader;
+        if (!reader && !d.delivering) {
+            d.rx.release(d.rx.available);   // nobody would read the retained data, which are stale by now
+        }
+    }
+    if (reader) {
+        deliver(inst);  // the modem might be waiting for flow on, so don't wait for another frame
     }
+    update_rx_flow(inst);
 }
@@ -29,11 +29,7 @@ command_result generic_command(CommandableIf *t, const std::string &command,
                                uint32_t timeout_ms)
 {
     ESP_LOGD(TAG, "%s command %s\n", __func__, command.c_str());
-    return t->command(command, [&](uint8_t *data, size_t len) {
-        std::string_view response((char *)data, len);
-        if (data == nullptr || len == 0 || response.empty()) {
-            return command_result::TIMEOUT;
-        }
+    return t->command(command, [&](std::string_view response) {
         ESP_LOGD(TAG, "Response: %.*s\n", (int)response.length(), response.data());
         for (auto &it : pass_phrase)
             if (response.find(it) != std::string::npos) {
@@ -58,44 +54,26 @@ static inline command_result generic_command(CommandableIf *t, const std::string
     return generic_command(t, command, pass, fail, timeout_ms);
 }
 
-static inline command_result generic_get_string(CommandableIf *t, const std::string &command, std::string_view &output, uint32_t timeout_ms = 500)
+static inline command_result generic_get_string(CommandableIf *t, const std::string &command, std::string &output, uint32_t timeout_ms = 500)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    return t->command(command, [&](uint8_t *data, size_t len) {
-        size_t pos = 0;
-        std::string_view response((char *)data, len);
-        while ((pos = response.find('\n')) != std::string::npos) {
-            std::string_view token = response.substr(0, pos);
-            for (auto it = token.end() - 1; it > token.begin(); it--) // strip trailing CR or LF
-                if (*it == '\r' || *it == '\n') {
-                    token.remove_suffix(1);
-                }
-            ESP_LOGV(TAG, "Token: {%.*s}\n", static_cast<int>(token.size()), token.data());
-
-            if (token.find("OK") != std::string::npos) {
-                return command_result::OK;
-            } else if (token.find("ERROR") != std::string::npos) {
-                return command_result::FAIL;
-            } else if (token.size() > 2) {
-                output = token;
-            }
-            response = response.substr(pos + 1);
+    return t->command(command, [&](std::string_view token) {
+        while (!token.empty() && (token.back() == '\r' || token.back() == '\n')) { // strip trailing CR or LF
+            token.remove_suffix(1);
+        }
+        ESP_LOGV(TAG, "Token: {%.*s}\n", static_cast<int>(token.size()), token.data());
+
+        if (token.find("OK") != std::string::npos) {
+            return command_result::OK;
+        } else if (token.find("ERROR") != std::string::npos) {
+            return command_result::FAIL;
+        } else if (token.size() > 2) {
+            output = token;
         }
         return command_result::TIMEOUT;
     }, timeout_ms);
 }
 
-static inline command_result generic_get_string(CommandableIf *t, const std::string &command, std::string &output, uint32_t timeout_ms = 500)
-{
-    ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
-    auto ret = generic_get_string(t, command, out, timeout_ms);
-    if (ret == command_result::OK) {
-        output = out;
-    }
-    return ret;
-}
-
 
 static inline command_result generic_command_common(CommandableIf *t, const std::string &command, uint32_t timeout = 500)
 {
@@ -154,7 +132,7 @@ command_result hang_up(CommandableIf *t)
 command_result get_battery_status(CommandableIf *t, int &voltage, int &bcs, int &bcl)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
+    std::string out;
     auto ret = generic_get_string(t, "AT+CBC\r", out);
     if (ret != command_result::OK) {
         return ret;
@@ -166,8 +144,9 @@ command_result get_battery_status(CommandableIf *t, int &voltage, int &bcs, int
     }
     // Parsing +CBC: <bcs>,<bcl>,<voltage>
     out = out.substr(pattern.size());
-    int pos, value, property = 0;
-    while ((pos = out.find(',') != std::string::npos)) {
+    size_t pos;
+    int value, property = 0;
+    while ((pos = out.find(',')) != std::string::npos) {
         if (std::from_chars(out.data(), out.data() + pos, value).ec == std::errc::invalid_argument) {
             return command_result::FAIL;
         }
@@ -190,7 +169,7 @@ command_result get_battery_status(CommandableIf *t, int &voltage, int &bcs, int
 command_result get_battery_status_sim7xxx(CommandableIf *t, int &voltage, int &bcs, int &bcl)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
+    std::string out;
     auto ret = generic_get_string(t, "AT+CBC\r", out);
     if (ret != command_result::OK) {
         return ret;
@@ -225,7 +204,7 @@ command_result set_flow_control(CommandableIf *t, int dce_flow, int dte_flow)
 command_result get_operator_name(CommandableIf *t, std::string &operator_name)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
+    std::string out;
     auto ret = generic_get_string(t, "AT+COPS?\r", out, 75000);
     if (ret != command_result::OK) {
         return ret;
@@ -344,10 +323,16 @@ command_result set_cmux(CommandableIf *t)
     return generic_command_common(t, "AT+CMUX=0\r");
 }
 
+command_result set_cmux_advanced(CommandableIf *t)
+{
+    ESP_LOGV(TAG, "%s", __func__ );
+    return generic_command_common(t, "AT+CMUX=1\r");
+}
+
 command_result read_pin(CommandableIf *t, bool &pin_ok)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
+    std::string out;
     auto ret = generic_get_string(t, "AT+CPIN?\r", out);
     if (ret != command_result::OK) {
         return ret;
@@ -376,7 +361,7 @@ command_result set_pin(CommandableIf *t, const std::string &pin)
 command_result get_signal_quality(CommandableIf *t, int &rssi, int &ber)
 {
     ESP_LOGV(TAG, "%s", __func__ );
-    std::string_view out;
+    std::string out;
     auto ret = generic_get_string(t, "AT+CSQ\r", out);
     if (ret != command_result::OK) {
         return ret;
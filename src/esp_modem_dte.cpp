@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstring>
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
@@ -20,30 +21,70 @@
 using namespace esp_modem;
 
 static const size_t dte_default_buffer_size = 1000;
+static const size_t dte_default_command_queue_size = 8;
+static const size_t dispatcher_task_stack_size = 4096;
+static const size_t dispatcher_task_priority = 5;
+static const size_t tx_flusher_task_stack_size = 2048;
+static const size_t tx_flusher_task_priority = 5;
+static const uint32_t dte_default_tx_latency_us = 1000;
+static const char *TAG = "dte";
 
 DTE::DTE(const esp_modem_dte_config *config, std::unique_ptr<Terminal> terminal):
     buffer_size(config->dte_buffer_size), consumed(0),
-    buffer(std::make_unique<uint8_t[]>(buffer_size)),
+    buffer(std::make_unique<uint8_t[]>(buffer_size)), cmux_config(config->cmux_config),
     term(std::move(terminal)), command_term(term.get()), other_term(nullptr),
-    mode(modem_mode::UNDEF) {}
+    mode(modem_mode::UNDEF),
+    command_queue_size(config->command_queue_size ? config->command_queue_size : dte_default_command_queue_size),
+    overflow_policy(config->overflow_policy),
+    tx_coalesce_size(config->tx_coalesce_size),
+    // the flusher sleeps in scheduler ticks, so the bound is rounded up to whole milliseconds
+    tx_latency_ms(((config->tx_coalesce_latency_us ? config->tx_coalesce_latency_us : dte_default_tx_latency_us) + 999) / 1000) {}
 
 DTE::DTE(std::unique_ptr<Terminal> terminal):
     buffer_size(dte_default_buffer_size), consumed(0),
-    buffer(std::make_unique<uint8_t[]>(buffer_size)),
+    buffer(std::make_unique<uint8_t[]>(buffer_size)), cmux_config(),
     term(std::move(terminal)), command_term(term.get()), other_term(nullptr),
-    mode(modem_mode::UNDEF) {}
+    mode(modem_mode::UNDEF), command_queue_size(dte_default_command_queue_size),
+    overflow_policy(ESP_MODEM_DTE_OVERFLOW_DROP_OLDEST),
+    tx_coalesce_size(0), tx_latency_ms(0) {}
+
+DTE::~DTE()
+{
+    signal.set(TASKS_STOP);
+    dispatcher.reset();
+    tx_task.reset();
+}
+
+static std::string solicited_prefix_of(const std::string &command)
+{
+    if (command.compare(0, 3, "AT+") == 0) {  // "AT+CREG?\r" is answered by "+CREG: ..."
+        return command.substr(2, command.find_first_of("=?\r") - 2);
+    }
+    return {};
+}
 
 command_result DTE::command(const std::string &command, got_line_cb got_line, uint32_t time_ms, const char separator)
 {
     Scoped<Lock> l(lock);
     command_result res = command_result::TIMEOUT;
+    solicited_prefix = solicited_prefix_of(command);
     command_term->set_read_cb([&](uint8_t *data, size_t len) {
+        if (res != command_result::TIMEOUT) {
+            return true;    // already finished, waiting for the caller to take the result
+        }
         if (!data) {
+            if (consumed >= buffer_size && !make_room(separator)) {
+                res = command_result::BUFFER_OVERFLOW;
+                signal.set(GOT_LINE);
+                return true;
+            }
             data = buffer.get();
             len = command_term->read(data + consumed, buffer_size - consumed);
         } else {
             consumed = 0; // if the underlying terminal contains data, we cannot fragment
         }
+        len = route_urcs(data, consumed + len, separator) - consumed;
+        stats.high_water = std::max(stats.high_water, consumed + len);
         if (memchr(data + consumed, separator, len)) {
             res = got_line(data, consumed + len);
             if (res == command_result::OK || res == command_result::FAIL) {
@@ -60,26 +101,322 @@ command_result DTE::command(const std::string &command, got_line_cb got_line, ui
         throw_if_esp_fail(ESP_ERR_INVALID_STATE);
     }
     consumed = 0;
+    solicited_prefix.clear();
     command_term->set_read_cb(nullptr);
+    set_idle_read_cb();
     return res;
 }
 
+size_t DTE::route_urcs(uint8_t *data, size_t end, char separator)
+{
+    {
+        Scoped<Lock> u(urc_lock);
+        if (urc_trie.empty()) {
+            return end;
+        }
+    }
+    size_t pos = consumed;  // the line completed by the new data started after the last separator
+    while (pos > 0 && data[pos - 1] != separator) {
+        pos--;
+    }
+    while (pos < end) {
+        auto sep = static_cast<uint8_t *>(memchr(data + pos, separator, end - pos));
+        if (sep == nullptr) {
+            break;
+        }
+        size_t next = sep - data + 1;
+        std::string_view current(reinterpret_cast<const char *>(data + pos), next - 1 - pos);
+        if (!current.empty() && current.back() == '\r') {
+            current.remove_suffix(1);
+        }
+        if (current.empty() || !dispatch_urc(current)) {
+            pos = next;
+            continue;
+        }
+        // hide the routed line from the response parser
+        memmove(data + pos, data + next, end - next);
+        end -= next - pos;
+        consumed = std::min(consumed, pos);
+    }
+    return end;
+}
+
 command_result DTE::command(const std::string &cmd, got_line_cb got_line, uint32_t time_ms)
 {
     return command(cmd, got_line, time_ms, '\n');
 }
 
+bool DTE::make_room(char separator)
+{
+    stats.overflows++;
+    if (overflow_policy == ESP_MODEM_DTE_OVERFLOW_FAIL) {
+        ESP_LOGW(TAG, "Response exceeds the buffer of %d bytes", static_cast<int>(buffer_size));
+        return false;
+    }
+    // drop the complete lines (already passed to the callback), or the older half of an overlong line
+    auto data = buffer.get();
+    size_t drop = consumed / 2;
+    for (size_t i = consumed; i > 0; --i) {
+        if (data[i - 1] == separator) {
+            drop = i;
+            break;
+        }
+    }
+    memmove(data, data + drop, consumed - drop);
+    consumed -= drop;
+    stats.dropped += drop;
+    return true;
+}
+
+command_result DTE::frame_lines(const uint8_t *data, size_t len, char separator, const line_cb &got_line)
+{
+    auto end = data + len;
+    while (data < end) {
+        auto sep = static_cast<const uint8_t *>(memchr(data, separator, end - data));
+        if (sep == nullptr) {
+            size_t limit = buffer_size ? buffer_size : dte_default_buffer_size;
+            if (line.size() + (end - data) > limit) {
+                stats.overflows++;
+                if (overflow_policy == ESP_MODEM_DTE_OVERFLOW_FAIL) {
+                    ESP_LOGW(TAG, "Response line exceeds %d bytes", static_cast<int>(limit));
+                    line.clear();
+                    return command_result::BUFFER_OVERFLOW;
+                }
+                stats.dropped += line.size();
+                line.clear();
+                if (static_cast<size_t>(end - data) > limit) {  // keep only the tail of an overlong chunk
+                    stats.dropped += (end - data) - limit;
+                    data = end - limit;
+                }
+            }
+            line.append(reinterpret_cast<const char *>(data), end - data);
+            stats.high_water = std::max(stats.high_water, line.size());
+            return command_result::TIMEOUT;
+        }
+        std::string_view current(reinterpret_cast<const char *>(data), sep - data);
+        if (!line.empty()) {    // complete the carried over part
+            line.append(current);
+            current = line;
+        }
+        if (!current.empty() && current.back() == '\r') {
+            current.remove_suffix(1);
+        }
+        data = sep + 1;
+        auto res = command_result::TIMEOUT;
+        if (!current.empty() && !dispatch_urc(current) && got_line) {
+            res = got_line(current);
+        }
+        line.clear();
+        if (res != command_result::TIMEOUT) {
+            return res;
+        }
+    }
+    return command_result::TIMEOUT;
+}
+
+command_result DTE::command(const std::string &command, line_cb got_line, uint32_t time_ms, const char separator)
+{
+    Scoped<Lock> l(lock);
+    command_result res = command_result::TIMEOUT;
+    line.clear();
+    solicited_prefix = solicited_prefix_of(command);
+    command_term->set_read_cb([&](uint8_t *data, size_t len) {
+        if (res != command_result::TIMEOUT) {
+            return true;    // already finished, waiting for the caller to take the result
+        }
+        if (!data) {
+            data = buffer.get();
+            len = command_term->read(data, buffer_size);
+        }
+        res = frame_lines(data, len, separator, got_line);
+        if (res != command_result::TIMEOUT) {
+            signal.set(GOT_LINE);
+            return true;
+        }
+        return false;
+    });
+    command_term->write((uint8_t *)command.c_str(), command.length());
+    auto got_lf = signal.wait(GOT_LINE, time_ms);
+    if (got_lf && res == command_result::TIMEOUT) {
+        throw_if_esp_fail(ESP_ERR_INVALID_STATE);
+    }
+    line.clear();
+    solicited_prefix.clear();
+    command_term->set_read_cb(nullptr);
+    set_idle_read_cb();
+    return res;
+}
+
+bool DTE::set_buffer_size(size_t size)
+{
+    Scoped<Lock> l(lock);
+    if (size == 0 || mode == modem_mode::DATA_MODE || mode == modem_mode::CMUX_MODE || cmux_term) {
+        return false;
+    }
+    command_term->set_read_cb(nullptr);    // the idle URC listener reads into the buffer
+    buffer = std::make_unique<uint8_t[]>(size);
+    buffer_size = size;
+    consumed = 0;
+    set_idle_read_cb();
+    return true;
+}
+
+bool DTE::dispatch_urc(std::string_view line)
+{
+    if (!solicited_prefix.empty() && line.compare(0, solicited_prefix.size(), solicited_prefix) == 0) {
+        return false;
+    }
+    urc_cb cb;
+    {
+        Scoped<Lock> l(urc_lock);
+        if (urc_trie.empty()) {
+            return false;
+        }
+        auto id = urc_trie.match(line);
+        if (id == UrcTrie::NO_MATCH) {
+            return false;
+        }
+        cb = urc_handlers[id];
+    }
+    cb(line);
+    return true;
+}
+
+bool DTE::set_urc_cb(const std::string &prefix, urc_cb f)
+{
+    Scoped<Lock> l(lock);
+    {
+        Scoped<Lock> u(urc_lock);
+        auto id = urc_trie.find(prefix);    // every prefix has its own id
+        if (f == nullptr) {
+            if (id == UrcTrie::NO_MATCH || !urc_trie.remove(prefix)) {
+                return false;
+            }
+            urc_handlers[id] = nullptr;     // frees the slot (and the subscriber's closure)
+        } else {
+            if (id == UrcTrie::NO_MATCH) {  // reuse free slots
+                id = 0;
+                while (id < static_cast<int>(urc_handlers.size()) && urc_handlers[id] != nullptr) {
+                    id++;
+                }
+                if (id == static_cast<int>(urc_handlers.size())) {
+                    urc_handlers.emplace_back();
+                }
+            }
+            if (!urc_trie.insert(prefix, id)) {
+                return false;
+            }
+            urc_handlers[id] = std::move(f);
+        }
+    }
+    if (urc_trie.empty() && !(mode == modem_mode::DATA_MODE && command_term == term.get())) {
+        command_term->set_read_cb(nullptr);
+    }
+    set_idle_read_cb();
+    return true;
+}
+
+void DTE::set_idle_read_cb()
+{
+    if (command_term == nullptr) {
+        return;
+    }
+    bool listen;
+    {
+        Scoped<Lock> u(urc_lock);
+        listen = !urc_trie.empty();
+    }
+    if (mode == modem_mode::DATA_MODE && command_term == term.get()) {
+        return; // the terminal carries data
+    }
+    if (!listen) {
+        return;
+    }
+    command_term->set_read_cb([this](uint8_t *data, size_t len) {
+        if (!data) {
+            data = buffer.get();
+            len = command_term->read(data, buffer_size);
+        }
+        frame_lines(data, len, '\n', nullptr);
+        return false;
+    });
+}
+
+bool DTE::command_async(const std::string &command, line_cb got_line, uint32_t time_ms, std::function<void(command_result)> done)
+{
+    Scoped<Lock> l(queue_lock);
+    if (command_queue.size() >= command_queue_size) {
+        ESP_LOGW(TAG, "Command queue full, dropping %s", command.c_str());
+        return false;
+    }
+    command_queue.push_back({command, std::move(got_line), time_ms, std::move(done)});
+    if (!dispatcher) {
+        dispatcher = std::make_unique<Task>(dispatcher_task_stack_size, dispatcher_task_priority, this, [](void *p) {
+            static_cast<DTE *>(p)->dispatch();
+            Task::Delete();
+        });
+    }
+    signal.set(COMMAND_QUEUED);
+    return true;
+}
+
+std::future<command_result> DTE::command_async(const std::string &command, line_cb got_line, uint32_t time_ms)
+{
+    auto promise = std::make_shared<std::promise<command_result>>();
+    auto future = promise->get_future();
+    auto queued = command_async(command, std::move(got_line), time_ms, [promise](command_result res) {
+        promise->set_value(res);
+    });
+    if (!queued) {
+        promise->set_value(command_result::FAIL);
+    }
+    return future;
+}
+
+void DTE::dispatch()
+{
+    while (true) {
+        signal.wait_any(COMMAND_QUEUED | TASKS_STOP, portMAX_DELAY);
+        AsyncCommand cmd;
+        {
+            Scoped<Lock> l(queue_lock);
+            if (signal.is_any(TASKS_STOP)) {
+                break;
+            }
+            if (command_queue.empty()) {
+                signal.clear(COMMAND_QUEUED);
+                continue;
+            }
+            cmd = std::move(command_queue.front());
+            command_queue.pop_front();
+        }
+        auto res = command(cmd.command, cmd.got_line, cmd.time_ms);
+        if (cmd.done) {
+            cmd.done(res);
+        }
+    }
+    // complete the commands which were not sent
+    Scoped<Lock> l(queue_lock);
+    for (auto &cmd : command_queue) {
+        if (cmd.done) {
+            cmd.done(command_result::TIMEOUT);
+        }
+    }
+    command_queue.clear();
+}
+
 bool DTE::setup_cmux()
 {
     auto original_term = std::move(term);
     if (original_term == nullptr) {
         return false;
     }
-    auto cmux_term = std::make_shared<CMux>(std::move(original_term), std::move(buffer), buffer_size);
+    cmux_term = std::make_shared<CMux>(std::move(original_term), std::move(buffer), buffer_size, &cmux_config);
     if (cmux_term == nullptr) {
         return false;
     }
     buffer_size = 0;
+    cmux_term->set_link_down_cb(cmux_link_down_cb);
     if (!cmux_term->init()) {
         return false;
     }
@@ -92,8 +429,35 @@ bool DTE::setup_cmux()
     return true;
 }
 
+std::unique_ptr<Terminal> DTE::open_cmux_terminal(int inst)
+{
+    if (cmux_term == nullptr || inst < 2 || !cmux_term->open_terminal(inst)) {
+        return nullptr;
+    }
+    return std::make_unique<CMuxInstance>(cmux_term, inst);
+}
+
+bool DTE::close_cmux_terminal(int inst)
+{
+    if (cmux_term == nullptr || inst < 2) {
+        return false;
+    }
+    return cmux_term->close_terminal(inst);
+}
+
+void DTE::set_cmux_link_down_cb(std::function<void()> f)
+{
+    cmux_link_down_cb = std::move(f);
+    if (cmux_term) {
+        cmux_term->set_link_down_cb(cmux_link_down_cb);
+    }
+}
+
 bool DTE::set_mode(modem_mode m)
 {
+    if (mode == modem_mode::DATA_MODE && m != modem_mode::DATA_MODE) {
+        flush();
+    }
     mode = m;
     if (m == modem_mode::DATA_MODE) {
         term->set_read_cb(on_data);
@@ -101,8 +465,11 @@ bool DTE::set_mode(modem_mode m)
             command_term = other_term.get();
         }
     } else if (m == modem_mode::CMUX_MODE) {
-        return setup_cmux();
+        if (!setup_cmux()) {
+            return false;
+        }
     }
+    set_idle_read_cb();
     return true;
 }
 
@@ -132,5 +499,65 @@ int DTE::read(uint8_t **d, size_t len)
 
 int DTE::write(uint8_t *data, size_t len)
 {
-    return term->write(data, len);
+    if (tx_coalesce_size == 0 || mode != modem_mode::DATA_MODE) {
+        return term->write(data, len);
+    }
+    Scoped<Lock> l(tx_lock);
+    if (tx_pending + len > tx_coalesce_size) {
+        flush_tx();
+    }
+    if (len >= tx_coalesce_size) {  // nothing to gain, send the big chunk right away
+        return term->write(data, len);
+    }
+    if (!tx_buffer) {
+        tx_buffer = std::make_unique<uint8_t[]>(tx_coalesce_size);
+        tx_task = std::make_unique<Task>(tx_flusher_task_stack_size, tx_flusher_task_priority, this, [](void *p) {
+            static_cast<DTE *>(p)->tx_flusher();
+            Task::Delete();
+        });
+    }
+    memcpy(tx_buffer.get() + tx_pending, data, len);
+    tx_pending += len;
+    signal.set(TX_QUEUED);
+    return len;
+}
+
+void DTE::flush()
+{
+    Scoped<Lock> l(tx_lock);
+    flush_tx();
+}
+
+bool DTE::set_baud_rate(int baud_rate)
+{
+    flush();
+    return term->set_baud_rate(baud_rate);
+}
+
+size_t DTE::queued_bytes()
+{
+    Scoped<Lock> l(tx_lock);
+    return tx_pending + term->queued_bytes();
+}
+
+void DTE::flush_tx()
+{
+    if (tx_pending > 0) {
+        term->write(tx_buffer.get(), tx_pending);
+        tx_pending = 0;
+    }
+    signal.clear(TX_QUEUED);
+}
+
+void DTE::tx_flusher()
+{
+    while (true) {
+        signal.wait_any(TX_QUEUED | TASKS_STOP, portMAX_DELAY);
+        // give the following writes a chance to join the data, within the latency bound
+        if (signal.wait_any(TASKS_STOP, tx_latency_ms)) {
+            break;
+        }
+        Scoped<Lock> l(tx_lock);
+        flush_tx();
+    }
 }
\ No newline at end of file
@@ -20,6 +20,13 @@
 
 namespace esp_modem {
 
+static TickType_t to_ticks(uint32_t time_ms)
+{
+    // timeouts shorter than the tick period wait for the next tick instead of not waiting at all
+    TickType_t ticks = pdMS_TO_TICKS(time_ms);
+    return ticks == 0 && time_ms > 0 ? 1 : ticks;
+}
+
 void Lock::unlock()
 {
     xSemaphoreGiveRecursive(m);
@@ -60,7 +67,7 @@ void SignalGroup::clear(uint32_t bits)
 
 bool SignalGroup::wait(uint32_t flags, uint32_t time_ms)
 {
-    EventBits_t bits = xEventGroupWaitBits(event_group, flags, pdTRUE, pdTRUE, pdMS_TO_TICKS(time_ms));
+    EventBits_t bits = xEventGroupWaitBits(event_group, flags, pdTRUE, pdTRUE, to_ticks(time_ms));
     return bits & flags;
 }
 
@@ -71,7 +78,7 @@ bool SignalGroup::is_any(uint32_t flags)
 
 bool SignalGroup::wait_any(uint32_t flags, uint32_t time_ms)
 {
-    EventBits_t bits = xEventGroupWaitBits(event_group, flags, pdFALSE, pdFALSE, pdMS_TO_TICKS(time_ms));
+    EventBits_t bits = xEventGroupWaitBits(event_group, flags, pdFALSE, pdFALSE, to_ticks(time_ms));
     return bits & flags;
 }
 
@@ -0,0 +1,182 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "esp_log.h"
+#include "cxx_include/esp_modem_exception.hpp"
+#include "cxx_include/esp_modem_reactor.hpp"
+
+using namespace esp_modem;
+
+static const char *TAG = "reactor";
+static const int MAX_EVENTS = 16;
+
+Reactor::Reactor(size_t threads_num) :
+    epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+    throw_if_false(epoll_fd >= 0 && wake_fd >= 0, "Failed to create the reactor");
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;    // level triggered: never consumed, so that all threads exit
+    ev.data.fd = wake_fd;
+    throw_if_false(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == 0, "Failed to watch the eventfd");
+    for (size_t i = 0; i < std::max<size_t>(threads_num, 1); ++i) {
+        threads.emplace_back([this] { run(); });
+    }
+}
+
+Reactor::~Reactor()
+{
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        ESP_LOGE(TAG, "Failed to wake up the reactor threads: %d", errno);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+bool Reactor::arm(int fd, int op, const Entry &entry)
+{
+    struct epoll_event ev = {};
+    ev.events = (entry.read ? static_cast<uint32_t>(EPOLLIN) : 0U) |
+                (entry.write ? static_cast<uint32_t>(EPOLLOUT) : 0U) | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) != 0) {
+        ESP_LOGE(TAG, "Failed to watch fd=%d: %d", fd, errno);
+        return false;
+    }
+    return true;
+}
+
+bool Reactor::add(int fd, std::function<bool()> on_readable, std::function<bool()> on_writable)
+{
+    auto entry = std::make_shared<Entry>();
+    entry->on_readable = std::move(on_readable);
+    entry->on_writable = std::move(on_writable);
+    std::lock_guard<std::mutex> l(lock);
+    if (entries.count(fd) || !arm(fd, EPOLL_CTL_ADD, *entry)) {
+        return false;
+    }
+    entries[fd] = std::move(entry);
+    return true;
+}
+
+bool Reactor::rearm(int fd, bool read, bool write)
+{
+    std::lock_guard<std::mutex> l(lock);
+    auto it = entries.find(fd);
+    if (it == entries.end()) {
+        return false;
+    }
+    auto &entry = *it->second;
+    if (entry.running) {    // armed by the dispatching thread when the callbacks finish
+        entry.rearm_read |= read;
+        entry.rearm_write |= write;
+        return true;
+    }
+    entry.read |= read;
+    entry.write |= write;
+    return arm(fd, EPOLL_CTL_MOD, entry);
+}
+
+bool Reactor::rearm(int fd)
+{
+    return rearm(fd, true, false);
+}
+
+bool Reactor::rearm_writable(int fd)
+{
+    return rearm(fd, false, true);
+}
+
+void Reactor::remove(int fd)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        auto it = entries.find(fd);
+        if (it == entries.end()) {
+            return;
+        }
+        entry = std::move(it->second);
+        entries.erase(it);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    std::lock_guard<std::recursive_mutex> busy(entry->busy);  // wait for the running callback
+    entry->active = false;
+}
+
+void Reactor::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "epoll_wait failed: %d", errno);
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                return;
+            }
+            dispatch(fd, events[i].events);
+        }
+    }
+}
+
+void Reactor::dispatch(int fd, uint32_t events)
+{
+    std::shared_ptr<Entry> entry;
+    bool readable, writable;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        auto it = entries.find(fd);
+        if (it == entries.end()) {
+            return;
+        }
+        entry = it->second;
+        // errors and hang-ups are reported to the callbacks of the watched directions
+        readable = entry->read && (events & (EPOLLIN | EPOLLERR | EPOLLHUP));
+        writable = entry->write && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP));
+        entry->running = true;
+    }
+    std::lock_guard<std::recursive_mutex> busy(entry->busy);
+    bool read = entry->read;
+    bool write = entry->write;
+    if (entry->active && writable) {
+        write = entry->on_writable && entry->on_writable();
+    }
+    if (entry->active && readable) {
+        read = entry->on_readable();
+    }
+    std::lock_guard<std::mutex> l(lock);
+    entry->running = false;
+    entry->read = read || entry->rearm_read;
+    entry->write = write || entry->rearm_write;
+    entry->rearm_read = entry->rearm_write = false;
+    auto it = entries.find(fd);
+    if (it != entries.end() && it->second == entry && (entry->read || entry->write)) {    // not removed meanwhile
+        arm(fd, EPOLL_CTL_MOD, *entry);
+    }
+}
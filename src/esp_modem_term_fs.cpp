@@ -12,75 +12,101 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
 #include <optional>
+#include <vector>
 #include <unistd.h>
+#include <sys/socket.h>
 #include "cxx_include/esp_modem_dte.hpp"
 #include "esp_log.h"
 #include "esp_modem_config.h"
 #include "exception_stub.hpp"
+#include "vfs_termial.hpp"
+#if defined(CONFIG_IDF_TARGET_LINUX)
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include "cxx_include/esp_modem_reactor.hpp"
+#else
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+#include "esp_vfs_eventfd.h"
+#endif
+#endif
 
 static const char *TAG = "fs_terminal";
 
 namespace esp_modem {
 
 
-struct File {
-    explicit File(const esp_modem_dte_config *config):
-        fd(config->vfs_config.fd), deleter(config->vfs_config.deleter), resource(config->vfs_config.resource)
-    {}
-
-    ~File()
-    {
-        if (deleter) {
-            deleter(fd, resource);
-        }
-    }
-    int fd;
-    void (*deleter)(int fd, struct esp_modem_vfs_resource *res);
-    struct esp_modem_vfs_resource *resource;
-};
-
 class FdTerminal : public Terminal {
 public:
     explicit FdTerminal(const esp_modem_dte_config *config);
 
     ~FdTerminal() override;
 
-    void start() override
-    {
-        signal.set(TASK_START);
-    }
+    void start() override;
 
-    void stop() override
-    {
-        signal.clear(TASK_START);
-    }
+    void stop() override;
 
     int write(uint8_t *data, size_t len) override;
 
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    int writev(const struct iovec *iov, size_t count) override;
+#endif
+
     int read(uint8_t *data, size_t len) override;
 
-    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override
-    {
-        on_read = std::move(f);
-        signal.set(TASK_PARAMS);
-    }
+    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override;
+
+    void set_writable_cb(std::function<void()> f) override;
+
+    size_t queued_bytes() override;
+
+    bool set_baud_rate(int baud_rate) override;
 
 private:
     void task();
+    bool on_readable(std::function<bool(uint8_t *data, size_t len)> &on_read_priv);
+    size_t enqueue(const uint8_t *data, size_t len);
+    bool on_fd_writable();
+    void wake_up();
+    void create_wake_fd();
+    int write_fd(const uint8_t *data, size_t len);
+    bool check_connection(int error);
+    void reconnect();
 
     static const size_t TASK_INIT = SignalGroup::bit0;
     static const size_t TASK_START = SignalGroup::bit1;
     static const size_t TASK_STOP = SignalGroup::bit2;
     static const size_t TASK_PARAMS = SignalGroup::bit3;
+    static const uint32_t TX_POLL_MS = 10;      /*!< select() timeout checking the queue if there's no eventfd */
 
     File f;
     SignalGroup signal;
-    Task task_handle;
+    Lock lock{};                                /*!< Protects the read callback */
+    struct esp_modem_reactor *reactor;          /*!< Shared reactor, if used instead of the task */
+    std::function<bool(uint8_t *data, size_t len)> reactor_on_read; /*!< Read callback used from the reactor */
+    Lock tx_lock{};                             /*!< Protects the outbound queue and the writable callback */
+    std::vector<uint8_t> tx_queue;              /*!< Data accepted while the fd would block, sent from tx_head on */
+    size_t tx_head = 0;
+    size_t tx_queue_size;
+    uint32_t read_poll_ms;                      /*!< Period of checking for data below the wake-up threshold of the fd */
+    uint32_t reconnect_min_ms;
+    uint32_t reconnect_max_ms;
+    std::atomic<bool> connection_lost{false};   /*!< The task reconnects, the writes are queued meanwhile */
+    bool is_socket = false;                     /*!< Written with send() to avoid SIGPIPE (Linux only) */
+    int wake_fd = -1;                           /*!< eventfd waking up the task to watch the writability */
+    std::unique_ptr<Task> task_handle;
 };
 
 std::unique_ptr<Terminal> create_vfs_terminal(const esp_modem_dte_config *config)
 {
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (config->vfs_config.io_backend == ESP_MODEM_VFS_IO_URING) {
+        return create_uring_terminal(config);
+    }
+#endif
     TRY_CATCH_RET_NULL(
         auto term = std::make_unique<FdTerminal>(config);
         term->start();
@@ -89,14 +115,116 @@ std::unique_ptr<Terminal> create_vfs_terminal(const esp_modem_dte_config *config
 }
 
 FdTerminal::FdTerminal(const esp_modem_dte_config *config) :
-    f(config), signal(),
-    task_handle(config->task_stack_size, config->task_priority, this, [](void *p)
+    f(config), signal(), reactor(config->vfs_config.reactor),
+    tx_queue_size(config->vfs_config.tx_queue_size > 0 ? config->vfs_config.tx_queue_size : 8192),
+    read_poll_ms(config->vfs_config.read_poll_ms),
+    reconnect_min_ms(config->vfs_config.reconnect_min_ms), reconnect_max_ms(config->vfs_config.reconnect_max_ms)
+{
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    int type;
+    socklen_t type_len = sizeof(type);
+    is_socket = getsockopt(f.fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0;
+    if (reactor && (read_poll_ms > 0 || f.reconnect)) {
+        ESP_LOGW(TAG, "Periodic reads and reconnecting are not available with the shared reactor, using a task");
+        reactor = nullptr;
+    }
+    if (reactor) {
+        return;
+    }
+#else
+    if (reactor) {
+        ESP_LOGW(TAG, "The shared reactor is available on Linux only, using a task");
+        reactor = nullptr;
+    }
+#endif
+    create_wake_fd();
+    task_handle = std::make_unique<Task>(config->task_stack_size, config->task_priority, this, [](void *p) {
+        auto t = static_cast<FdTerminal *>(p);
+        t->task();
+        Task::Delete();
+    });
+}
+
+void FdTerminal::create_wake_fd()
+{
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    throw_if_false(wake_fd >= 0, "Failed to create the eventfd");
+#elif ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&eventfd_config);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {    // might have been registered by the application
+        wake_fd = eventfd(0, 0);
+    }
+#endif
+    if (wake_fd < 0) {
+        ESP_LOGW(TAG, "No eventfd available, checking the outbound queue every %d ms", static_cast<int>(TX_POLL_MS));
+    }
+}
+
+void FdTerminal::start()
+{
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (reactor) {
+        if (!signal.is_any(TASK_START)) {
+            signal.set(TASK_START | TASK_PARAMS);
+            reactor->add(f.fd, [this] {
+                return on_readable(reactor_on_read);
+            }, [this] {
+                return on_fd_writable();
+            });
+            if (queued_bytes() > 0) {
+                reactor->rearm_writable(f.fd);
+            }
+        }
+        return;
+    }
+#endif
+    signal.set(TASK_START);
+}
+
+void FdTerminal::stop()
 {
-    auto t = static_cast<FdTerminal *>(p);
-    t->task();
-    Task::Delete();
-})
-{}
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (reactor) {
+        signal.clear(TASK_START);
+        reactor->remove(f.fd);
+        return;
+    }
+#endif
+    signal.clear(TASK_START);
+    wake_up();
+}
+
+void FdTerminal::set_read_cb(std::function<bool(uint8_t *data, size_t len)> f_cb)
+{
+    {
+        Scoped<Lock> l(lock);
+        on_read = std::move(f_cb);
+        signal.set(TASK_PARAMS);
+    }
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (reactor && signal.is_any(TASK_START)) {
+        reactor->rearm(f.fd);   // deliver the data which might be already waiting
+    }
+#endif
+}
+
+bool FdTerminal::on_readable(std::function<bool(uint8_t *data, size_t len)> &on_read_priv)
+{
+    if (signal.is_any(TASK_PARAMS)) {
+        Scoped<Lock> l(lock);
+        on_read_priv = on_read;
+        signal.clear(TASK_PARAMS);
+    }
+    if (!on_read_priv) {
+        return false;   // leave the data in the descriptor until a callback is set
+    }
+    if (on_read_priv(nullptr, 0)) {
+        on_read_priv = nullptr;
+    }
+    return true;
+}
 
 void FdTerminal::task()
 {
@@ -108,16 +236,38 @@ void FdTerminal::task()
     }
 
     while (signal.is_any(TASK_START)) {
+        if (connection_lost) {
+            reconnect();
+            continue;
+        }
         int s;
+        int max_fd = f.fd;
         fd_set rfds;
+        fd_set wfds;
         struct timeval tv = {
             .tv_sec = 1,
             .tv_usec = 0,
         };
+        if (read_poll_ms > 0) {
+            tv.tv_sec = read_poll_ms / 1000;
+            tv.tv_usec = (read_poll_ms % 1000) * 1000;
+        }
+        if (wake_fd < 0 && (read_poll_ms == 0 || read_poll_ms > TX_POLL_MS)) {
+            tv.tv_sec = 0;      // nothing would wake us up when the data get queued
+            tv.tv_usec = TX_POLL_MS * 1000;
+        }
         FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
         FD_SET(f.fd, &rfds);
+        if (queued_bytes() > 0) {
+            FD_SET(f.fd, &wfds);
+        }
+        if (wake_fd >= 0) {
+            FD_SET(wake_fd, &rfds);
+            max_fd = std::max(max_fd, wake_fd);
+        }
 
-        s = select(f.fd + 1, &rfds, nullptr, nullptr, &tv);
+        s = select(max_fd + 1, &rfds, &wfds, nullptr, &tv);
         if (signal.is_any(TASK_PARAMS)) {
             on_read_priv = on_read;
             signal.clear(TASK_PARAMS);
@@ -127,12 +277,26 @@ void FdTerminal::task()
             break;
         } else if (s == 0) {
 //            ESP_LOGV(TAG, "Select exited with timeout");
+#if defined(CONFIG_IDF_TARGET_LINUX)
+            int available = 0;
+            if (read_poll_ms > 0 && ioctl(f.fd, FIONREAD, &available) == 0 && available > 0) {
+                on_readable(on_read_priv);  // less than the wake-up threshold, but nothing more is coming
+            }
+#endif
         } else {
-            if (FD_ISSET(f.fd, &rfds)) {
-                if (on_read_priv) {
-                    if (on_read_priv(nullptr, 0)) {
-                        on_read_priv = nullptr;
-                    }
+            if (wake_fd >= 0 && FD_ISSET(wake_fd, &rfds)) {
+                uint64_t count;
+                if (::read(wake_fd, &count, sizeof(count)) < 0) {
+                    ESP_LOGD(TAG, "Nothing to read from the eventfd: %d", errno);
+                }
+            }
+            if (FD_ISSET(f.fd, &wfds)) {
+                on_fd_writable();
+            }
+            if (FD_ISSET(f.fd, &rfds) && !on_readable(on_read_priv) && f.reconnect) {
+                char c;     // nobody reads, but the connection could be closed
+                if (recv(f.fd, &c, 1, MSG_PEEK) == 0) {
+                    check_connection(ECONNRESET);
                 }
             }
         }
@@ -140,32 +304,229 @@ void FdTerminal::task()
     }
 }
 
+bool FdTerminal::check_connection(int error)
+{
+    if (!f.reconnect || (error != ECONNRESET && error != EPIPE && error != ENOTCONN && error != ETIMEDOUT)) {
+        return false;
+    }
+    if (!connection_lost.exchange(true)) {
+        wake_up();
+    }
+    return true;
+}
+
+void FdTerminal::reconnect()
+{
+    int lost_fd;
+    {
+        Scoped<Lock> l(tx_lock);
+        lost_fd = f.fd;
+        f.fd = -1;
+    }
+    if (lost_fd >= 0) {
+        close(lost_fd);
+        ESP_LOGW(TAG, "Connection lost, reconnecting");
+    }
+    uint32_t delay_ms = reconnect_min_ms;
+    while (signal.is_any(TASK_START)) {
+        if (signal.wait_any(TASK_STOP, delay_ms)) {
+            return;
+        }
+        int fd = f.reconnect(f.resource);
+        if (fd >= 0) {
+            Scoped<Lock> l(tx_lock);
+            f.fd = fd;
+            connection_lost = false;
+            ESP_LOGI(TAG, "Reconnected (fd=%d), %d bytes queued", fd, static_cast<int>(tx_queue.size() - tx_head));
+            return;
+        }
+        delay_ms = std::min(delay_ms * 2, reconnect_max_ms);
+    }
+}
+
 int FdTerminal::read(uint8_t *data, size_t len)
 {
     int size = ::read(f.fd, data, len);
     if (size < 0) {
-        if (errno != EAGAIN) {
+        if (errno != EAGAIN && !check_connection(errno)) {
             ESP_LOGE(TAG, "Error occurred during read: %d", errno);
         }
         return 0;
     }
-
+    if (size == 0 && len > 0) {
+        check_connection(ECONNRESET);   // end of stream
+    }
     return size;
 }
 
+int FdTerminal::write_fd(const uint8_t *data, size_t len)
+{
+    if (f.fd < 0) {     // reconnecting
+        errno = EAGAIN;
+        return -1;
+    }
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (is_socket) {
+        return ::send(f.fd, data, len, MSG_NOSIGNAL);
+    }
+#endif
+    return ::write(f.fd, data, len);
+}
+
 int FdTerminal::write(uint8_t *data, size_t len)
 {
-    int size = ::write(f.fd, data, len);
-    if (size < 0) {
-        ESP_LOGE(TAG, "Error occurred during read: %d", errno);
-        return 0;
+    Scoped<Lock> l(tx_lock);
+    size_t size = 0;
+    if (tx_head == tx_queue.size()) {   // nothing queued, so the data could go directly
+        int written = write_fd(data, len);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && !check_connection(errno)) {
+                ESP_LOGE(TAG, "Error occurred during write: %d", errno);
+                return 0;
+            }
+            written = 0;
+        }
+        size = written;
+    }
+    return size + enqueue(data + size, len - size);
+}
+
+#if defined(CONFIG_IDF_TARGET_LINUX)
+int FdTerminal::writev(const struct iovec *iov, size_t count)
+{
+    Scoped<Lock> l(tx_lock);
+    size_t size = 0;
+    if (tx_head == tx_queue.size() && f.fd >= 0) {
+        struct msghdr msg = {};
+        msg.msg_iov = const_cast<struct iovec *>(iov);
+        msg.msg_iovlen = count;
+        int written = is_socket ? ::sendmsg(f.fd, &msg, MSG_NOSIGNAL) : ::writev(f.fd, iov, count);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && !check_connection(errno)) {
+                ESP_LOGE(TAG, "Error occurred during writev: %d", errno);
+                return 0;
+            }
+            written = 0;
+        }
+        size = written;
+    }
+    size_t skip = size;
+    for (size_t i = 0; i < count; ++i) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t len = iov[i].iov_len - skip;
+        size_t queued = enqueue(static_cast<const uint8_t *>(iov[i].iov_base) + skip, len);
+        size += queued;
+        skip = 0;
+        if (queued < len) {
+            break;
+        }
     }
     return size;
 }
+#endif
+
+size_t FdTerminal::enqueue(const uint8_t *data, size_t len)
+{
+    size_t queued = tx_queue.size() - tx_head;
+    len = std::min(len, tx_queue_size - queued);
+    if (len == 0) {
+        return 0;
+    }
+    if (tx_head > 0) {
+        tx_queue.erase(tx_queue.begin(), tx_queue.begin() + tx_head);
+        tx_head = 0;
+    }
+    tx_queue.insert(tx_queue.end(), data, data + len);
+    if (queued == 0 && f.fd >= 0) {  // start watching the writability
+#if defined(CONFIG_IDF_TARGET_LINUX)
+        if (reactor) {
+            reactor->rearm_writable(f.fd);
+            return len;
+        }
+#endif
+        wake_up();
+    }
+    return len;
+}
+
+bool FdTerminal::on_fd_writable()
+{
+    std::function<void()> writable_cb;
+    {
+        Scoped<Lock> l(tx_lock);
+        if (tx_head == tx_queue.size()) {
+            return false;
+        }
+        while (tx_head < tx_queue.size()) {
+            int size = write_fd(tx_queue.data() + tx_head, tx_queue.size() - tx_head);
+            if (size < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;    // keep watching
+                }
+                if (check_connection(errno)) {
+                    return false;   // sent after reconnecting
+                }
+                ESP_LOGE(TAG, "Error occurred during write, dropping %d queued bytes: %d",
+                         static_cast<int>(tx_queue.size() - tx_head), errno);
+                break;
+            }
+            tx_head += size;
+        }
+        tx_queue.clear();
+        tx_head = 0;
+        writable_cb = on_writable;
+    }
+    if (writable_cb) {
+        writable_cb();
+    }
+    return false;
+}
+
+void FdTerminal::wake_up()
+{
+    uint64_t one = 1;
+    if (wake_fd >= 0 && ::write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        ESP_LOGE(TAG, "Failed to wake up the terminal task: %d", errno);
+    }
+    // without the eventfd, the task checks the queue after TX_POLL_MS
+}
+
+void FdTerminal::set_writable_cb(std::function<void()> f_cb)
+{
+    Scoped<Lock> l(tx_lock);
+    on_writable = std::move(f_cb);
+}
+
+bool FdTerminal::set_baud_rate(int baud_rate)
+{
+    if (!f.set_baud_rate) {
+        return false;
+    }
+    Scoped<Lock> l(tx_lock);
+    if (tx_head != tx_queue.size()) {
+        ESP_LOGW(TAG, "Cannot change the baud rate with %d bytes queued", static_cast<int>(tx_queue.size() - tx_head));
+        return false;
+    }
+    return f.set_baud_rate(f.fd, f.resource, baud_rate);
+}
+
+size_t FdTerminal::queued_bytes()
+{
+    Scoped<Lock> l(tx_lock);
+    return tx_queue.size() - tx_head;
+}
 
 FdTerminal::~FdTerminal()
 {
     stop();
+    signal.set(TASK_STOP);  // in case the task has not been started yet
+    task_handle.reset();    // joins the task on Linux, before closing its eventfd
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
 }
 
 } // namespace esp_modem
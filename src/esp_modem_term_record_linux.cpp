@@ -0,0 +1,416 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "cxx_include/esp_modem_recorder.hpp"
+#include "exception_stub.hpp"
+
+static const char *TAG = "recorder";
+
+namespace esp_modem {
+
+namespace {
+
+constexpr char LOG_MAGIC[4] = { 'E', 'M', 'R', 'L' };
+constexpr uint32_t LOG_VERSION = 1;
+constexpr size_t LOG_HEADER_SIZE = 16;          /* magic, version, valid length */
+constexpr size_t LOG_LENGTH_OFFSET = 8;
+constexpr size_t DEFAULT_LOG_CAPACITY = 1024 * 1024;
+constexpr size_t MAX_RECORD_HEADER = 1 + 10 + 10;
+constexpr uint8_t RECORD_READ = 0;
+constexpr uint8_t RECORD_WRITE = 1;
+
+int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t put_leb128(uint8_t *out, uint64_t value)
+{
+    size_t len = 0;
+    do {
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        out[len++] = b | (value ? 0x80 : 0);
+    } while (value);
+    return len;
+}
+
+bool get_leb128(const uint8_t *data, size_t len, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; pos < len && shift < 64; shift += 7) {
+        uint8_t b = data[pos++];
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+RecordingTerminal::RecordingTerminal(std::unique_ptr<Terminal> t, const char *path, size_t cap):
+    term(std::move(t)), capacity(std::max(cap > 0 ? cap : DEFAULT_LOG_CAPACITY, LOG_HEADER_SIZE + MAX_RECORD_HEADER)),
+    used(LOG_HEADER_SIZE), last_us(now_us())
+{
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    throw_if_false(fd >= 0, "Failed to create the log");
+    if (ftruncate(fd, capacity) != 0 ||
+            (map = static_cast<uint8_t *>(mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) == MAP_FAILED) {
+        map = nullptr;
+        close(fd);
+        throw_if_false(false, "Failed to map the log");
+    }
+    memcpy(map, LOG_MAGIC, sizeof(LOG_MAGIC));
+    memcpy(map + sizeof(LOG_MAGIC), &LOG_VERSION, sizeof(LOG_VERSION));
+    uint64_t length = used;
+    memcpy(map + LOG_LENGTH_OFFSET, &length, sizeof(length));
+    term->set_error_cb([this](terminal_error err) {
+        if (on_error) {
+            on_error(err);
+        }
+    });
+}
+
+RecordingTerminal::~RecordingTerminal()
+{
+    term.reset();   // no more callbacks recording into the log
+    if (map) {
+        munmap(map, capacity);
+    }
+    if (fd >= 0) {
+        if (ftruncate(fd, used) != 0) {
+            ESP_LOGW(TAG, "Failed to trim the log: %d", errno);
+        }
+        close(fd);
+    }
+}
+
+void RecordingTerminal::record(uint8_t type, const struct iovec *iov, size_t count, size_t len)
+{
+    uint8_t header[MAX_RECORD_HEADER];
+    std::lock_guard<std::mutex> l(log_lock);
+    if (map == nullptr) {
+        return;
+    }
+    int64_t now = now_us();
+    size_t header_len = 0;
+    header[header_len++] = type;
+    header_len += put_leb128(header + header_len, now - last_us);
+    header_len += put_leb128(header + header_len, len);
+    if (used + header_len + len > capacity) {   // grow the log
+        size_t new_capacity = std::max(capacity * 2, used + header_len + len);
+        void *new_map = MAP_FAILED;
+        if (ftruncate(fd, new_capacity) == 0) {
+            new_map = mremap(map, capacity, new_capacity, MREMAP_MAYMOVE);
+        }
+        if (new_map == MAP_FAILED) {
+            ESP_LOGE(TAG, "Failed to extend the log, recording stopped: %d", errno);
+            munmap(map, capacity);
+            map = nullptr;
+            return;
+        }
+        map = static_cast<uint8_t *>(new_map);
+        capacity = new_capacity;
+    }
+    last_us = now;
+    memcpy(map + used, header, header_len);
+    size_t pos = used + header_len;
+    for (size_t i = 0; i < count && len > 0; ++i) {
+        size_t piece = std::min(iov[i].iov_len, len);
+        memcpy(map + pos, iov[i].iov_base, piece);
+        pos += piece;
+        len -= piece;
+    }
+    used = pos;
+    // publish the record only when complete
+    __atomic_store_n(reinterpret_cast<uint64_t *>(map + LOG_LENGTH_OFFSET), static_cast<uint64_t>(used), __ATOMIC_RELEASE);
+}
+
+void RecordingTerminal::set_read_cb(std::function<bool(uint8_t *data, size_t len)> f)
+{
+    if (f == nullptr) {
+        term->set_read_cb(nullptr);
+        return;
+    }
+    term->set_read_cb([this, f = std::move(f)](uint8_t *data, size_t len) {
+        if (data) {     // data passed directly, read() is not called for them
+            struct iovec iov = { data, len };
+            record(RECORD_READ, &iov, 1, len);
+        }
+        return f(data, len);
+    });
+}
+
+void RecordingTerminal::set_writable_cb(std::function<void()> f)
+{
+    term->set_writable_cb(std::move(f));
+}
+
+size_t RecordingTerminal::queued_bytes()
+{
+    return term->queued_bytes();
+}
+
+int RecordingTerminal::write(uint8_t *data, size_t len)
+{
+    if (len > 0) {
+        struct iovec iov = { data, len };
+        record(RECORD_WRITE, &iov, 1, len);
+    }
+    int written = term->write(data, len);
+    if (written >= 0 && static_cast<size_t>(written) < len) {
+        ESP_LOGD(TAG, "Terminal accepted %d of %d recorded bytes", written, static_cast<int>(len));
+    }
+    return written;
+}
+
+int RecordingTerminal::writev(const struct iovec *iov, size_t count)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += iov[i].iov_len;
+    }
+    if (len > 0) {
+        record(RECORD_WRITE, iov, count, len);
+    }
+    int written = term->writev(iov, count);
+    if (written >= 0 && static_cast<size_t>(written) < len) {
+        ESP_LOGD(TAG, "Terminal accepted %d of %d recorded bytes", written, static_cast<int>(len));
+    }
+    return written;
+}
+
+int RecordingTerminal::read(uint8_t *data, size_t len)
+{
+    int actual = term->read(data, len);
+    if (actual > 0) {
+        struct iovec iov = { data, static_cast<size_t>(actual) };
+        record(RECORD_READ, &iov, 1, actual);
+    }
+    return actual;
+}
+
+bool RecordingTerminal::set_baud_rate(int baud_rate)
+{
+    return term->set_baud_rate(baud_rate);
+}
+
+void RecordingTerminal::start()
+{
+    term->start();
+}
+
+void RecordingTerminal::stop()
+{
+    term->stop();
+}
+
+size_t RecordingTerminal::log_size()
+{
+    std::lock_guard<std::mutex> l(log_lock);
+    return used;
+}
+
+ReplayTerminal::ReplayTerminal(const char *path, bool rt, uint32_t sync_ms):
+    realtime(rt), write_sync_ms(sync_ms)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    throw_if_false(fd >= 0, "Failed to open the log");
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < LOG_HEADER_SIZE ||
+            (log = static_cast<uint8_t *>(mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) == MAP_FAILED) {
+        log = nullptr;
+        close(fd);
+        throw_if_false(false, "Failed to map the log");
+    }
+    close(fd);
+    log_len = st.st_size;
+    uint32_t version;
+    uint64_t length;
+    memcpy(&version, log + sizeof(LOG_MAGIC), sizeof(version));
+    memcpy(&length, log + LOG_LENGTH_OFFSET, sizeof(length));
+    if (memcmp(log, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || version != LOG_VERSION || length > log_len) {
+        munmap(log, log_len);
+        log = nullptr;
+        throw_if_false(false, "Invalid log");
+    }
+    // sum up the reads, to know when all of them have been consumed
+    log_end = length;
+    for (size_t pos = LOG_HEADER_SIZE; pos < log_end;) {
+        size_t record = pos;
+        uint8_t type = log[pos++];
+        uint64_t delta, len;
+        if (!get_leb128(log, log_end, pos, delta) || !get_leb128(log, log_end, pos, len) || len > log_end - pos) {
+            ESP_LOGW(TAG, "Truncated record at %u, replaying the log up to it", static_cast<unsigned>(record));
+            log_end = record;
+            break;
+        }
+        if (type == RECORD_READ) {
+            total_read += len;
+        }
+        pos += len;
+    }
+}
+
+ReplayTerminal::~ReplayTerminal()
+{
+    stop();
+    if (log) {
+        munmap(log, log_len);
+    }
+}
+
+void ReplayTerminal::start()
+{
+    stop();
+    {
+        std::lock_guard<std::mutex> l(lock);
+        pending.clear();
+        written = 0;
+        finished = false;
+        running = true;
+    }
+    replay_thread = std::thread([this] { replay(); });
+}
+
+void ReplayTerminal::stop()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        running = false;
+    }
+    cv.notify_all();
+    if (replay_thread.joinable() && replay_thread.get_id() != std::this_thread::get_id()) {
+        replay_thread.join();
+    }
+}
+
+void ReplayTerminal::replay()
+{
+    auto start = std::chrono::steady_clock::now();
+    int64_t time_us = 0;
+    size_t expected_written = 0;
+    size_t pos = LOG_HEADER_SIZE;
+    while (pos < log_end) {
+        uint8_t type = log[pos++];
+        uint64_t delta, len;
+        if (!get_leb128(log, log_end, pos, delta) || !get_leb128(log, log_end, pos, len) || len > log_end - pos) {
+            break;
+        }
+        const uint8_t *data = log + pos;
+        pos += len;
+        time_us += delta;
+        if (type == RECORD_WRITE) {
+            expected_written += len;
+            continue;
+        }
+        {
+            std::unique_lock<std::mutex> l(lock);
+            if (realtime) {
+                cv.wait_until(l, start + std::chrono::microseconds(time_us), [this] { return !running; });
+            }
+            if (write_sync_ms > 0) {    // the response should not overtake its command
+                cv.wait_for(l, std::chrono::milliseconds(write_sync_ms), [&] { return !running || written >= expected_written; });
+            }
+            if (!running) {
+                return;
+            }
+            pending.insert(pending.end(), data, data + len);
+        }
+        deliver();
+    }
+    {
+        std::lock_guard<std::mutex> l(lock);
+        finished = true;
+    }
+    cv.notify_all();
+    while (deliver()) {     // no more data would trigger the delivery of the rest
+        std::unique_lock<std::mutex> l(lock);
+        cv.wait_for(l, std::chrono::milliseconds(REDELIVER_MS));
+        if (!running) {
+            return;
+        }
+    }
+}
+
+bool ReplayTerminal::deliver()
+{
+    std::function<bool(uint8_t *data, size_t len)> on_read_priv;
+    size_t available;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        on_read_priv = on_read;
+        available = pending.size();
+    }
+    while (available > 0 && on_read_priv) {
+        on_read_priv(nullptr, available);
+        std::lock_guard<std::mutex> l(lock);
+        if (pending.size() == available) {
+            break;      // not consumed now, delivered again with the next data
+        }
+        available = pending.size();
+    }
+    return available > 0;
+}
+
+void ReplayTerminal::set_read_cb(std::function<bool(uint8_t *data, size_t len)> f)
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        on_read = std::move(f);
+    }
+    cv.notify_all();
+}
+
+int ReplayTerminal::write(uint8_t *data, size_t len)
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        written += len;
+    }
+    cv.notify_all();
+    return len;
+}
+
+int ReplayTerminal::read(uint8_t *data, size_t len)
+{
+    size_t read_len;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        read_len = std::min(len, pending.size());
+        memcpy(data, pending.data(), read_len);
+        pending.erase(pending.begin(), pending.begin() + read_len);
+    }
+    cv.notify_all();
+    return read_len;
+}
+
+bool ReplayTerminal::wait_until_done(uint32_t timeout_ms)
+{
+    std::unique_lock<std::mutex> l(lock);
+    return cv.wait_for(l, std::chrono::milliseconds(timeout_ms), [this] { return finished && pending.empty(); });
+}
+
+} // namespace esp_modem
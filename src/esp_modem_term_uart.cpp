@@ -66,10 +66,22 @@ uart_resource::uart_resource(const esp_modem_uart_term_config *config, QueueHand
     throw_if_esp_fail(res, "install uart driver failed");
     throw_if_esp_fail(uart_set_rx_timeout(config->port_num, 1), "set rx timeout failed");
 
-    throw_if_esp_fail(uart_set_rx_full_threshold(config->port_num, 64), "config rx full threshold failed");
+    int rx_full_threshold = 64;
+    if (config->latency_profile == ESP_MODEM_SERIAL_LOW_LATENCY) {
+        rx_full_threshold = 1;
+    } else if (config->latency_profile == ESP_MODEM_SERIAL_THROUGHPUT) {
+        rx_full_threshold = UART_FIFO_LEN - 8;
+    }
+    throw_if_esp_fail(uart_set_rx_full_threshold(config->port_num, rx_full_threshold), "config rx full threshold failed");
 
     /* mark UART as initialized */
     port = config->port_num;
 }
 
+bool uart_resource::set_baud_rate(int baud_rate)
+{
+    uart_wait_tx_done(port, pdMS_TO_TICKS(100));  // the pending data go out at the former rate
+    return uart_set_baudrate(port, baud_rate) == ESP_OK;
+}
+
 } // namespace esp_modem
@@ -0,0 +1,408 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "esp_log.h"
+#include "cxx_include/esp_modem_dte.hpp"
+#include "exception_stub.hpp"
+#include "vfs_termial.hpp"
+
+static const char *TAG = "uring_terminal";
+
+namespace esp_modem {
+
+/**
+ * @brief Minimal io_uring wrapper using the raw system calls (no liburing dependency)
+ */
+class Uring {
+public:
+    explicit Uring(unsigned entries)
+    {
+        struct io_uring_params p = {};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        throw_if_false(fd >= 0, "io_uring_setup failed");
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr :
+                 mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        throw_if_false(sq_ptr != MAP_FAILED && cq_ptr != MAP_FAILED && sqes != MAP_FAILED, "io_uring mmap failed");
+        auto sq = static_cast<uint8_t *>(sq_ptr);
+        sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sq_entries = p.sq_entries;
+        auto cq = static_cast<uint8_t *>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    }
+
+    ~Uring()
+    {
+        munmap(sqes, sqes_size);
+        if (cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        munmap(sq_ptr, sq_size);
+        close(fd);
+    }
+
+    bool register_buffers(const struct iovec *iov, unsigned count)
+    {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+    }
+
+    /**
+     * @brief Queues one submission and enters the kernel (thread safe)
+     * @param entry Submission entry
+     * @param wait_completion Also wait (in the same system call) until a completion is available
+     */
+    bool submit(const struct io_uring_sqe &entry, bool wait_completion = false)
+    {
+        std::lock_guard<std::mutex> l(sq_lock);
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return false;
+        }
+        unsigned index = tail & sq_mask;
+        sqes[index] = entry;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        return syscall(__NR_io_uring_enter, fd, 1, wait_completion ? 1 : 0,
+                       wait_completion ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) >= 0;
+    }
+
+    /**
+     * @brief Waits for the next completion (a single consumer only)
+     */
+    bool wait(struct io_uring_cqe &cqe)
+    {
+        while (true) {
+            unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                cqe = cqes[head & cq_mask];
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+private:
+    int fd;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    std::mutex sq_lock;
+};
+
+/**
+ * @brief VFS terminal keeping a read always posted to io_uring
+ *
+ * Two registered buffers are used in turns: as soon as a read completes, the next one is posted
+ * to the other buffer, and the received data are offered to the on_read callback (which reads them
+ * by read()). Writes use a separate ring, each call is one (vectored) request submitted and completed
+ * in a single system call, so it may be issued from the read callback too.
+ *
+ * Writes are not queued across calls: the stream has no ordering between independent requests
+ * and a short write would need the data of the requests queued behind it to be resubmitted, while
+ * the caller's buffers are only valid until writev() returns. Batching is therefore done by the
+ * callers, which gather a whole round (e.g. all CMUX frames of a scheduler round) into one writev().
+ */
+class UringTerminal : public Terminal {
+public:
+    explicit UringTerminal(const esp_modem_dte_config *config);
+
+    ~UringTerminal() override;
+
+    void start() override;
+
+    void stop() override;
+
+    int write(uint8_t *data, size_t len) override;
+
+    int writev(const struct iovec *iov, size_t count) override;
+
+    int read(uint8_t *data, size_t len) override;
+
+    void set_read_cb(std::function<bool(uint8_t *data, size_t len)> f) override;
+
+private:
+    static constexpr unsigned RING_ENTRIES = 16;
+    static constexpr size_t READ_BUFFERS = 2;
+    static constexpr size_t READ_BUFFER_SIZE = 4096;
+    static constexpr uint64_t STOP_TAG = 0;     /*!< user_data of the NOP stopping the completion thread, reads use 1..READ_BUFFERS */
+    static constexpr uint64_t CANCEL_TAG = READ_BUFFERS + 1;    /*!< user_data of the requests cancelling the posted read */
+
+    void run();
+    bool post_read(size_t i);
+    void deliver();
+
+    File f;
+    std::unique_ptr<uint8_t[]> buffers; /*!< Declared before the rings, so it outlives any read posted to them */
+    Uring ring;                         /*!< Reads, completed by the completion thread */
+    Uring tx_ring;                      /*!< Writes, completed by the writer */
+    std::mutex tx_lock;
+    std::mutex lock;                    /*!< Protects the state below */
+    std::condition_variable cv;
+    bool started = false;
+    bool stopping = false;
+    bool read_posted = false;
+    size_t reads_in_flight = 0;         /*!< Reads posted and not completed yet */
+    bool params_changed = false;
+    const uint8_t *rx_data = nullptr;   /*!< Completed read being delivered (accessed from the completion thread) */
+    size_t rx_len = 0;
+    size_t rx_pos = 0;
+    std::thread completion;
+};
+
+std::unique_ptr<Terminal> create_uring_terminal(const esp_modem_dte_config *config)
+{
+    TRY_CATCH_RET_NULL(
+        auto term = std::make_unique<UringTerminal>(config);
+        term->start();
+        return term;
+    )
+}
+
+UringTerminal::UringTerminal(const esp_modem_dte_config *config) :
+    f(config), buffers(std::make_unique<uint8_t[]>(READ_BUFFERS * READ_BUFFER_SIZE)), ring(RING_ENTRIES), tx_ring(RING_ENTRIES)
+{
+    struct iovec iov[READ_BUFFERS];
+    for (size_t i = 0; i < READ_BUFFERS; ++i) {
+        iov[i].iov_base = buffers.get() + i * READ_BUFFER_SIZE;
+        iov[i].iov_len = READ_BUFFER_SIZE;
+    }
+    throw_if_false(ring.register_buffers(iov, READ_BUFFERS), "Failed to register io_uring buffers");
+    completion = std::thread([this] { run(); });
+}
+
+UringTerminal::~UringTerminal()
+{
+    {
+        // no read gets posted once stopping is set, so cancelling under the lock catches all of them
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+        for (uint64_t tag = 1; tag <= READ_BUFFERS; ++tag) {
+            struct io_uring_sqe cancel = {};
+            cancel.opcode = IORING_OP_ASYNC_CANCEL;
+            cancel.addr = tag;
+            cancel.user_data = CANCEL_TAG;
+            ring.submit(cancel);
+        }
+    }
+    cv.notify_all();
+    struct io_uring_sqe nop = {};
+    nop.opcode = IORING_OP_NOP;
+    nop.user_data = STOP_TAG;
+    if (!ring.submit(nop)) {
+        ESP_LOGE(TAG, "Failed to stop the completion thread");
+    }
+    completion.join();  // returns once the cancelled reads completed, the buffers are not used anymore
+}
+
+void UringTerminal::start()
+{
+    bool post = false;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        started = true;
+        if (!read_posted) {
+            read_posted = post = true;
+        }
+    }
+    cv.notify_all();
+    if (post) {
+        post_read(0);
+    }
+}
+
+void UringTerminal::stop()
+{
+    std::lock_guard<std::mutex> l(lock);
+    started = false;    // the received data are kept until started again
+}
+
+void UringTerminal::set_read_cb(std::function<bool(uint8_t *data, size_t len)> f_cb)
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        on_read = std::move(f_cb);
+        params_changed = true;
+    }
+    cv.notify_all();
+}
+
+bool UringTerminal::post_read(size_t i)
+{
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.fd = f.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffers.get() + i * READ_BUFFER_SIZE);
+    sqe.len = READ_BUFFER_SIZE;
+    sqe.off = static_cast<uint64_t>(-1);    // current position (streams)
+    sqe.buf_index = i;
+    sqe.user_data = i + 1;
+    std::lock_guard<std::mutex> l(lock);
+    if (stopping) {
+        return false;
+    }
+    if (!ring.submit(sqe)) {
+        ESP_LOGE(TAG, "Failed to post a read");
+        return false;
+    }
+    ++reads_in_flight;
+    return true;
+}
+
+void UringTerminal::run()
+{
+    struct io_uring_cqe cqe;
+    bool stop = false;
+    while (ring.wait(cqe)) {
+        if (cqe.user_data == STOP_TAG) {
+            stop = true;
+        } else if (cqe.user_data != CANCEL_TAG) {
+            std::lock_guard<std::mutex> l(lock);
+            --reads_in_flight;
+        }
+        if (stop) {
+            std::lock_guard<std::mutex> l(lock);
+            if (reads_in_flight == 0) {
+                return;
+            }
+            continue;
+        }
+        if (cqe.user_data == CANCEL_TAG) {
+            continue;
+        }
+        size_t i = cqe.user_data - 1;
+        if (cqe.res <= 0) {
+            if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+                post_read(i);
+            } else if (cqe.res != -ECANCELED) {
+                ESP_LOGE(TAG, "Read failed or the peer closed: %d", cqe.res);
+            }
+            continue;
+        }
+        post_read((i + 1) % READ_BUFFERS);  // keep reading while the data are processed
+        rx_data = buffers.get() + i * READ_BUFFER_SIZE;
+        rx_len = cqe.res;
+        rx_pos = 0;
+        deliver();
+    }
+    ESP_LOGE(TAG, "Waiting for io_uring completions failed: %d", errno);
+}
+
+void UringTerminal::deliver()
+{
+    std::function<bool(uint8_t *data, size_t len)> on_read_priv;
+    bool have_cb = false;
+    while (rx_pos < rx_len) {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            if (stopping) {
+                return;
+            }
+            if (params_changed || !have_cb) {
+                on_read_priv = on_read;
+                params_changed = false;
+                have_cb = true;
+            }
+            if (!started || !on_read_priv) {    // keep the data until somebody wants them
+                cv.wait_for(l, std::chrono::milliseconds(100));
+                have_cb = false;
+                continue;
+            }
+        }
+        auto before = rx_pos;
+        if (on_read_priv(nullptr, rx_len - rx_pos)) {
+            on_read_priv = nullptr;
+        }
+        if (rx_pos == before) {     // the consumer isn't ready, retry later
+            std::unique_lock<std::mutex> l(lock);
+            cv.wait_for(l, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+int UringTerminal::read(uint8_t *data, size_t len)
+{
+    len = std::min(len, rx_len - rx_pos);
+    if (len > 0) {
+        memcpy(data, rx_data + rx_pos, len);
+        rx_pos += len;
+    }
+    return len;
+}
+
+int UringTerminal::writev(const struct iovec *iov, size_t count)
+{
+    struct io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.fd = f.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(iov);
+    sqe.len = count;
+    sqe.off = static_cast<uint64_t>(-1);
+    struct io_uring_cqe cqe;
+    std::lock_guard<std::mutex> l(tx_lock);
+    if (!tx_ring.submit(sqe, true) || !tx_ring.wait(cqe)) {
+        ESP_LOGE(TAG, "Failed to submit a write: %d", errno);
+        return 0;
+    }
+    if (cqe.res < 0) {
+        ESP_LOGE(TAG, "Error occurred during write: %d", -cqe.res);
+        return 0;
+    }
+    return cqe.res;
+}
+
+int UringTerminal::write(uint8_t *data, size_t len)
+{
+    struct iovec iov = { data, len };
+    return writev(&iov, 1);
+}
+
+} // namespace esp_modem
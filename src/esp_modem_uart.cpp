@@ -76,6 +76,11 @@ public:
         signal.set(TASK_PARAMS);
     }
 
+    bool set_baud_rate(int baud_rate) override
+    {
+        return uart.set_baud_rate(baud_rate);
+    }
+
 private:
     static void s_task(void *task_param)
     {
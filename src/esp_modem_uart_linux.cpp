@@ -12,8 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <termios.h>
+#include <cerrno>
+#include <asm/termbits.h>   // termios2 with arbitrary baud rates (BOTHER), instead of <termios.h>
 #include <sys/ioctl.h>
+#include <linux/serial.h>
 #include "esp_log.h"
 #include "cxx_include/esp_modem_dte.hpp"
 #include "esp_modem_config.h"
@@ -22,34 +24,100 @@
 namespace esp_modem {
 
 constexpr const char *TAG = "uart_resource";
+constexpr int THROUGHPUT_VMIN = 64;         /*!< Wake-up threshold of the throughput profile (select() honors VMIN if VTIME is 0) */
+constexpr uint32_t THROUGHPUT_POLL_MS = 5;  /*!< Period of picking up the data below the threshold */
 
-uart_resource::uart_resource(const esp_modem_uart_term_config *config, QueueHandle_t *event_queue, int fd): port(-1)
+static void set_speed(struct termios2 &tty, int baud_rate)
+{
+    tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tty.c_ispeed = baud_rate;
+    tty.c_ospeed = baud_rate;
+}
+
+uart_resource::uart_resource(const esp_modem_uart_term_config *config, QueueHandle_t *event_queue, int fd): port(-1), fd(fd)
 {
     ESP_LOGD(TAG, "Creating uart resource" );
-    struct termios tty = {};
-    throw_if_false(tcgetattr(fd, &tty) == 0, "Failed to tcgetattr()");
-
-    tty.c_cflag &= ~PARENB;
-    tty.c_cflag &= ~CSTOPB;
-    tty.c_cflag &= ~CSIZE; // Clear all the size bits, then use one of the statements below
-    tty.c_cflag |= CS8; // 8 bits per byte (most common)
-    tty.c_cflag &= ~CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
+    struct termios2 tty = {};
+    throw_if_false(ioctl(fd, TCGETS2, &tty) == 0, "Failed to get the serial line settings");
+
+    // zero initialized config (no baud rate) keeps the defaults of 115200 8N1 without flow control
+    bool configured = config->baud_rate > 0;
+    tty.c_cflag &= ~(PARENB | PARODD | CSTOPB | CSIZE | CRTSCTS);
+    switch (configured ? config->data_bits : UART_DATA_8_BITS) {
+    case UART_DATA_5_BITS:
+        tty.c_cflag |= CS5;
+        break;
+    case UART_DATA_6_BITS:
+        tty.c_cflag |= CS6;
+        break;
+    case UART_DATA_7_BITS:
+        tty.c_cflag |= CS7;
+        break;
+    default:
+        tty.c_cflag |= CS8;
+        break;
+    }
+    if (configured && config->stop_bits != UART_STOP_BITS_1) {
+        tty.c_cflag |= CSTOPB;  // 2 stop bits, or 1.5 with 5 data bits
+    }
+    if (configured && config->parity == UART_PARITY_EVEN) {
+        tty.c_cflag |= PARENB;
+    } else if (configured && config->parity == UART_PARITY_ODD) {
+        tty.c_cflag |= PARENB | PARODD;
+    }
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
+    if (configured && config->flow_control == ESP_MODEM_FLOW_CONTROL_HW) {
+        tty.c_cflag |= CRTSCTS;
+    } else if (configured && config->flow_control == ESP_MODEM_FLOW_CONTROL_SW) {
+        tty.c_iflag |= IXON | IXOFF;
+    }
     tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
     tty.c_lflag &= ~ICANON;
     tty.c_lflag &= ~ECHO; // Disable echo
     tty.c_lflag &= ~ISIG; // Disable interpretation of INTR, QUIT and SUSP
-    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
     tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL); // Disable any special handling of received bytes
     tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
     tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
     tty.c_cc[VTIME] = 0;
     tty.c_cc[VMIN] = 0;
-    cfsetispeed(&tty, B115200);
-    cfsetospeed(&tty, B115200);
-    cfsetspeed(&tty, B115200);
-    ioctl(fd, TCSETS, &tty);
+    if (config->latency_profile == ESP_MODEM_SERIAL_THROUGHPUT) {
+        tty.c_cc[VMIN] = THROUGHPUT_VMIN;
+        read_poll_ms = THROUGHPUT_POLL_MS;
+    }
+    set_speed(tty, configured ? config->baud_rate : 115200);
+    throw_if_false(ioctl(fd, TCSETS2, &tty) == 0, "Failed to set the serial line settings");
+
+    if (config->latency_profile != ESP_MODEM_SERIAL_LATENCY_DEFAULT) {
+        // USB serial drivers (e.g. ftdi_sio) shorten their latency timer in the low latency mode
+        struct serial_struct serial = {};
+        bool low_latency = config->latency_profile == ESP_MODEM_SERIAL_LOW_LATENCY;
+        if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+            serial.flags = low_latency ? (serial.flags | ASYNC_LOW_LATENCY) : (serial.flags & ~ASYNC_LOW_LATENCY);
+            if (ioctl(fd, TIOCSSERIAL, &serial) != 0) {
+                ESP_LOGW(TAG, "Failed to set the serial driver latency mode: %d", errno);
+            }
+        } else if (low_latency) {
+            ESP_LOGW(TAG, "Low latency mode not supported by the device: %d", errno);
+        }
+    }
+}
+
+bool uart_resource::set_baud_rate(int baud_rate)
+{
+    struct termios2 tty = {};
+    if (ioctl(fd, TCGETS2, &tty) != 0) {
+        ESP_LOGE(TAG, "Failed to get the serial line settings: %d", errno);
+        return false;
+    }
+    set_speed(tty, baud_rate);
+    if (ioctl(fd, TCSETSW2, &tty) != 0) {   // applied after the pending output is transmitted
+        ESP_LOGE(TAG, "Failed to set baud rate %d: %d", baud_rate, errno);
+        return false;
+    }
+    return true;
 }
 
 uart_resource::~uart_resource() = default;
 
-} // namespace esp_modem
\ No newline at end of file
+} // namespace esp_modem
@@ -0,0 +1,92 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cxx_include/esp_modem_urc.hpp"
+
+using namespace esp_modem;
+
+uint16_t UrcTrie::find_child(uint16_t node, char c) const
+{
+    for (auto i = nodes[node].child; i != NONE; i = nodes[i].sibling) {
+        if (nodes[i].c == c) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+uint16_t UrcTrie::find_node(std::string_view prefix) const
+{
+    uint16_t node = 0;
+    for (auto c : prefix) {
+        if ((node = find_child(node, c)) == NONE) {
+            return NONE;
+        }
+    }
+    return node;
+}
+
+bool UrcTrie::insert(std::string_view prefix, int id)
+{
+    if (prefix.empty()) {
+        return false;
+    }
+    uint16_t node = 0;
+    for (auto c : prefix) {
+        auto next = find_child(node, c);
+        if (next == NONE) {
+            next = static_cast<uint16_t>(nodes.size());
+            nodes.push_back({ c, NO_MATCH, NONE, nodes[node].child });
+            nodes[node].child = next;
+        }
+        node = next;
+    }
+    if (nodes[node].id == NO_MATCH) {
+        entries++;
+    }
+    nodes[node].id = id;
+    return true;
+}
+
+bool UrcTrie::remove(std::string_view prefix)
+{
+    auto node = find_node(prefix);
+    if (node == NONE || nodes[node].id == NO_MATCH) {
+        return false;
+    }
+    nodes[node].id = NO_MATCH;  // the path is kept, it will be reused if the prefix is registered again
+    entries--;
+    return true;
+}
+
+int UrcTrie::find(std::string_view prefix) const
+{
+    auto node = find_node(prefix);
+    return node == NONE ? NO_MATCH : nodes[node].id;
+}
+
+int UrcTrie::match(std::string_view line) const
+{
+    int id = NO_MATCH;
+    uint16_t node = 0;
+    for (auto c : line) {
+        if ((node = find_child(node, c)) == NONE) {
+            break;
+        }
+        if (nodes[node].id != NO_MATCH) {
+            id = nodes[node].id;
+        }
+    }
+    return id;
+}
@@ -13,92 +13,186 @@
 // limitations under the License.
 
 #include <cstring>
+#include <memory>
+#include <string>
 #include <unistd.h>
 #include <sys/fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#if defined(CONFIG_IDF_TARGET_LINUX)
+#include <sys/un.h>
+#endif
 #include "esp_log.h"
 #include "esp_modem_config.h"
 #include "cxx_include/esp_modem_exception.hpp"
 #include "exception_stub.hpp"
-#include "uart_resource.hpp"
+#include "vfs_resource.hpp"
 #include "vfs_resource/vfs_create.hpp"
 
 
 constexpr const char *TAG = "vfs_socket_creator";
+constexpr const char *UNIX_PREFIX = "unix:";
+
+/**
+ * @brief Endpoint of the socket, kept to reconnect
+ */
+struct vfs_socket_resource : public esp_modem_vfs_resource {
+    std::string host;
+    int port;
+    int rcvbuf_size;
+    int sndbuf_size;
+};
+
+static void set_socket_options(int fd, const vfs_socket_resource *endpoint, int family)
+{
+    if (endpoint->rcvbuf_size > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &endpoint->rcvbuf_size, sizeof(endpoint->rcvbuf_size)) != 0) {
+        ESP_LOGW(TAG, "[sock=%d] Failed to set the receive buffer size", fd);
+    }
+    if (endpoint->sndbuf_size > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &endpoint->sndbuf_size, sizeof(endpoint->sndbuf_size)) != 0) {
+        ESP_LOGW(TAG, "[sock=%d] Failed to set the send buffer size", fd);
+    }
+    if (family == AF_INET || family == AF_INET6) {
+        int one = 1;    // AT commands are short writes waiting for a response, Nagle would delay them
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0) {
+            ESP_LOGW(TAG, "[sock=%d] Failed to disable Nagle's algorithm", fd);
+        }
+    }
+}
+
+#if defined(CONFIG_IDF_TARGET_LINUX)
+static int unix_socket_to_fd(const vfs_socket_resource *endpoint)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    const char *path = endpoint->host.c_str() + strlen(UNIX_PREFIX);
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        ESP_LOGE(TAG, "Unix socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to create unix socket");
+        return -1;
+    }
+    set_socket_options(fd, endpoint, AF_UNIX);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+        ESP_LOGE(TAG, "[sock=%d] Failed to connect to %s", fd, path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
 
 /**
  * @brief socket VFS
  * @note: Remote command:
  * socat TCP-L:2222 GOPEN:/dev/ttyS0,ispeed=115200,ospeed=1152000,b115200,raw,echo=0
+ * @return Connected socket, tried on all the resolved (IPv6 and IPv4) addresses in order, -1 on failure
  */
-static esp_err_t hostname_to_fd(const char *host, int port, int *fd)
+static int inet_socket_to_fd(const vfs_socket_resource *endpoint)
 {
-    struct sockaddr_storage address = {};
     struct addrinfo *address_info;
     struct addrinfo hints = {};
-    memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
 
-    int res = getaddrinfo(host, nullptr, &hints, &address_info);
+    std::string port = std::to_string(endpoint->port);
+    int res = getaddrinfo(endpoint->host.c_str(), port.c_str(), &hints, &address_info);
     if (res != 0 || address_info == nullptr) {
         ESP_LOGE(TAG, "couldn't get hostname for :%s: "
-                 "getaddrinfo() returns %d, addrinfo=%p", host, res, address_info);
-        return ESP_FAIL;
+                 "getaddrinfo() returns %d, addrinfo=%p", endpoint->host.c_str(), res, address_info);
+        return -1;
     }
-    *fd = socket(address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol);
-    if (*fd < 0) {
-        ESP_LOGE(TAG, "Failed to create socket (family %d socktype %d protocol %d)", address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol);
-        freeaddrinfo(address_info);
-        return ESP_FAIL;
+    int fd = -1;
+    for (auto *ai = address_info; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+            continue;
+        }
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            ESP_LOGE(TAG, "Failed to create socket (family %d socktype %d protocol %d)", ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            continue;
+        }
+        char name[INET6_ADDRSTRLEN] = "";
+        const void *addr = ai->ai_family == AF_INET ?
+                           static_cast<const void *>(&reinterpret_cast<struct sockaddr_in *>(ai->ai_addr)->sin_addr) :
+                           static_cast<const void *>(&reinterpret_cast<struct sockaddr_in6 *>(ai->ai_addr)->sin6_addr);
+        inet_ntop(ai->ai_family, addr, name, sizeof(name));
+        ESP_LOGI(TAG, "[sock=%d] Resolved IPv%d address: %s", fd, ai->ai_family == AF_INET ? 4 : 6, name);
+        set_socket_options(fd, endpoint, ai->ai_family);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            ESP_LOGE(TAG, "[sock=%d] Failed to connect", fd);
+            close(fd);
+            fd = -1;
+        }
     }
+    freeaddrinfo(address_info);
+    return fd;
+}
 
-    if (address_info->ai_family == AF_INET) {
-        auto *p = reinterpret_cast<struct sockaddr_in *>(address_info->ai_addr);
-        p->sin_port = htons(port);
-        ESP_LOGI(TAG, "[sock=%d] Resolved IPv4 address: %s", *fd, inet_ntoa(p->sin_addr));
-        memcpy(&address, p, sizeof(struct sockaddr ));
-    } else {
-        ESP_LOGE(TAG, "Unsupported protocol family %d", address_info->ai_family);
-        close(*fd);
-        freeaddrinfo(address_info);
-        return ESP_FAIL;
+static int endpoint_to_fd(const vfs_socket_resource *endpoint)
+{
+    int fd;
+#if defined(CONFIG_IDF_TARGET_LINUX)
+    if (endpoint->host.compare(0, strlen(UNIX_PREFIX), UNIX_PREFIX) == 0) {
+        fd = unix_socket_to_fd(endpoint);
+    } else
+#endif
+    {
+        fd = inet_socket_to_fd(endpoint);
     }
-
-    freeaddrinfo(address_info);
-    if (connect(*fd, (struct sockaddr *)&address, sizeof(struct sockaddr)) < 0) {
-        ESP_LOGE(TAG, "[sock=%d] Failed to connect", *fd);
-        return ESP_FAIL;
+    if (fd >= 0) {
+        // Set the FD to non-blocking mode
+        int flags = fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK;
+        fcntl(fd, F_SETFL, flags);
     }
-    return ESP_OK;
+    return fd;
 }
 
-
 static void vfs_destroy_socket(int fd, struct esp_modem_vfs_resource *resource)
 {
     if (fd >= 0) {
         close(fd);
     }
+    delete resource;
+}
+
+static int vfs_reconnect_socket(struct esp_modem_vfs_resource *resource)
+{
+    return endpoint_to_fd(static_cast<vfs_socket_resource *>(resource));
 }
 
 bool vfs_create_socket(struct esp_modem_vfs_socket_creator *config, struct esp_modem_vfs_term_config *created_config)
 {
-    if (config == nullptr || created_config == nullptr) {
+    if (config == nullptr || config->host_name == nullptr || created_config == nullptr) {
         return false;
     }
     TRY_CATCH_OR_DO(
-        int fd = -1;
-        esp_modem::throw_if_esp_fail(hostname_to_fd(config->host_name, config->port, &fd));
-
-        // Set the FD to non-blocking mode
-        int flags = fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK;
-        fcntl(fd, F_SETFL, flags);
+        *created_config = {};   // shares a union with the UART config, do not keep its values
+        auto endpoint = std::make_unique<vfs_socket_resource>();
+        endpoint->host = config->host_name;
+        endpoint->port = config->port;
+        endpoint->rcvbuf_size = config->rcvbuf_size;
+        endpoint->sndbuf_size = config->sndbuf_size;
+        int fd = endpoint_to_fd(endpoint.get());
+        esp_modem::throw_if_false(fd >= 0, "Cannot connect the socket");
 
         created_config->fd = fd;
         created_config->deleter = vfs_destroy_socket;
+        created_config->resource = endpoint.release();
+        if (config->reconnect_min_ms > 0) {
+            created_config->reconnect = vfs_reconnect_socket;
+            created_config->reconnect_min_ms = config->reconnect_min_ms;
+            created_config->reconnect_max_ms = config->reconnect_max_ms > 0 ? config->reconnect_max_ms : 30000;
+        }
         , return false)
     return true;
 }
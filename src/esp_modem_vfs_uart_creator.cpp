@@ -20,13 +20,14 @@
 #include "cxx_include/esp_modem_exception.hpp"
 #include "exception_stub.hpp"
 #include "uart_resource.hpp"
+#include "vfs_resource.hpp"
 #include "vfs_resource/vfs_create.hpp"
 
 constexpr const char *TAG = "vfs_uart_creator";
 
 
-struct esp_modem_vfs_resource {
-    explicit esp_modem_vfs_resource(const esp_modem_uart_term_config *config, int fd)
+struct vfs_uart_resource : public esp_modem_vfs_resource {
+    explicit vfs_uart_resource(const esp_modem_uart_term_config *config, int fd)
         : internal(config, nullptr, fd) {}
 
     esp_modem::uart_resource internal;
@@ -41,24 +42,37 @@ static void vfs_destroy_uart(int fd, struct esp_modem_vfs_resource *resource)
     delete resource;
 }
 
+static bool vfs_set_uart_baud_rate(int fd, struct esp_modem_vfs_resource *resource, int baud_rate)
+{
+    return static_cast<vfs_uart_resource *>(resource)->internal.set_baud_rate(baud_rate);
+}
+
 bool vfs_create_uart(struct esp_modem_vfs_uart_creator *config, struct esp_modem_vfs_term_config *created_config)
 {
     if (!config->dev_name || created_config == nullptr) {
         return false;
     }
+    int fd = -1;    // closed here on failure, owned by created_config->deleter on success
     TRY_CATCH_OR_DO(
-        int fd = open(config->dev_name, O_RDWR);
+        *created_config = {};   // shares a union with the UART config, do not keep its values
+        fd = open(config->dev_name, O_RDWR | O_NOCTTY);
         esp_modem::throw_if_false(fd >= 0, "Cannot open the fd");
 
-        created_config->resource = new esp_modem_vfs_resource(&config->uart, fd);
+        auto resource = new vfs_uart_resource(&config->uart, fd);
+        created_config->resource = resource;
         created_config->fd = fd;
         created_config->deleter = vfs_destroy_uart;
+        created_config->set_baud_rate = vfs_set_uart_baud_rate;
+        created_config->read_poll_ms = resource->internal.read_poll_ms;
 
         // Set the FD to non-blocking mode
         int flags = fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK;
         fcntl(fd, F_SETFL, flags);
 
-        , return false)
+        , if (fd >= 0) {
+            close(fd);
+        }
+        return false)
 
     return true;
 }
@@ -0,0 +1,800 @@
+// Copyright 2021 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cxx_include/esp_modem_api.hpp"
+#include "cxx_include/esp_modem_recorder.hpp"
+#include "cxx_include/esp_modem_cmux.hpp"
+#include "cxx_include/esp_modem_netif.hpp"
+#include "vfs_resource/vfs_create.hpp"
+#include "cmux_fcs.hpp"
+#include "cmux_advanced.hpp"
+#include "ModemSimulator.h"
+#include "LoopbackTerm.h"
+
+using namespace esp_modem;
+
+/**
+ * @brief One measured value, collected for the machine-readable output
+ */
+struct bench_result {
+    std::string name;       /*!< Benchmark and its parameters, e.g. "cmux_decode/fragment=64" */
+    double value;
+    const char *unit;
+};
+
+static std::vector<bench_result> results;
+
+static void report(std::string name, double value, const char *unit)
+{
+    results.push_back({ std::move(name), value, unit });
+}
+
+static std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+/**
+ * @brief Writes the results as a JSON array of {"name", "value", "unit"} objects ("-" for stdout)
+ */
+static bool write_json(const char *path)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (f == nullptr) {
+        printf("Cannot write %s\n", path);
+        return false;
+    }
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        fprintf(f, "  {\"name\": %s, \"value\": %.6g, \"unit\": \"%s\"}%s\n", json_string(results[i].name).c_str(),
+                results[i].value, results[i].unit, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+    if (f != stdout) {
+        fclose(f);
+    }
+    return true;
+}
+
+/**
+ * @brief Reference bit-by-bit FCS calculation, the way CMux used to compute it
+ */
+static uint8_t fcs_bitwise(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            if (crc & 0x01) {
+                crc = (crc >> 1) ^ 0xe0;
+            } else {
+                crc >>= 1;
+            }
+        }
+    }
+    return 0xFF - crc;
+}
+
+template<typename F>
+static double measure_ns_per_byte(const std::vector<uint8_t> &data, size_t chunk, size_t rounds, F &&fcs)
+{
+    volatile uint8_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i + chunk <= data.size(); i += chunk) {
+            sink = sink ^ fcs(&data[i], chunk);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return static_cast<double>(ns) / (static_cast<double>(data.size() / chunk * chunk) * rounds);
+}
+
+static void bench_fcs()
+{
+    std::vector<uint8_t> data(64 * 1024);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    // 3 bytes: header of UIH frames, 127 bytes: full payload of basic UI frames
+    for (size_t chunk : { 3, 127 }) {
+        auto bitwise = measure_ns_per_byte(data, chunk, 200, fcs_bitwise);
+        auto table = measure_ns_per_byte(data, chunk, 200, cmux_fcs::calculate);
+        printf("fcs chunk=%3zu: bitwise %.3f ns/B, table %.3f ns/B, speed-up %.2fx\n",
+               chunk, bitwise, table, bitwise / table);
+        report("fcs/bitwise/chunk=" + std::to_string(chunk), bitwise, "ns/B");
+        report("fcs/table/chunk=" + std::to_string(chunk), table, "ns/B");
+    }
+}
+
+/**
+ * @brief Reference byte-by-byte escaping of the advanced option frames
+ */
+static size_t escape_bytewise(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == cmux_advanced::FLAG || src[i] == cmux_advanced::ESCAPE) {
+            dst[out++] = cmux_advanced::ESCAPE;
+            dst[out++] = src[i] ^ cmux_advanced::ESCAPE_MASK;
+        } else {
+            dst[out++] = src[i];
+        }
+    }
+    return out;
+}
+
+template<typename F>
+static double measure_escape_ns_per_byte(const std::vector<uint8_t> &data, std::vector<uint8_t> &out, size_t rounds, F &&escape)
+{
+    volatile size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        sink = sink + escape(data.data(), data.size(), out.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return static_cast<double>(ns) / (static_cast<double>(data.size()) * rounds);
+}
+
+static bool bench_escape()
+{
+    std::vector<uint8_t> data(64 * 1024);
+    std::vector<uint8_t> out(2 * data.size());
+    std::vector<uint8_t> ref(2 * data.size());
+    // percentage of bytes to be escaped: plain text, compressed/encrypted payload and a worst case
+    for (unsigned percent : { 0, 1, 50 }) {
+        uint32_t seed = 1;
+        for (auto &b : data) {
+            seed = seed * 1103515245 + 12345;
+            b = (seed >> 16) % 100 < percent ? cmux_advanced::FLAG - (seed & 1) : static_cast<uint8_t>(seed >> 8) & 0x3F;
+        }
+        size_t len = cmux_advanced::escape(data.data(), data.size(), out.data());
+        if (len != escape_bytewise(data.data(), data.size(), ref.data()) || memcmp(out.data(), ref.data(), len) != 0) {
+            printf("Escaped data mismatch\n");
+            return false;
+        }
+        auto bytewise = measure_escape_ns_per_byte(data, out, 200, escape_bytewise);
+        auto vectorized = measure_escape_ns_per_byte(data, out, 200, cmux_advanced::escape);
+        printf("escape special=%2u%%: bytewise %.3f ns/B, vectorized %.3f ns/B, speed-up %.2fx\n",
+               percent, bytewise, vectorized, bytewise / vectorized);
+        report("escape/bytewise/special=" + std::to_string(percent) + "%", bytewise, "ns/B");
+        report("escape/vectorized/special=" + std::to_string(percent) + "%", vectorized, "ns/B");
+    }
+    return true;
+}
+
+/**
+ * @brief Measures the receive path of a VFS UART over a pseudo terminal with the given latency profile
+ *
+ * @note Pseudo terminals have no latency timer, so the low latency mode of USB serial drivers
+ * (ASYNC_LOW_LATENCY) is not exercised here, only the wake-up behavior of the terminal
+ */
+static bool bench_serial_profile(const char *name, esp_modem_serial_latency_t profile)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        printf("Cannot open a pseudo terminal\n");
+        return false;
+    }
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = ptsname(master),
+        .uart = {
+            .port_num = UART_NUM_1,
+            .data_bits = UART_DATA_8_BITS,
+            .stop_bits = UART_STOP_BITS_1,
+            .parity = UART_PARITY_DISABLE,
+            .flow_control = ESP_MODEM_FLOW_CONTROL_NONE,
+            .baud_rate = 3000000,
+            .latency_profile = profile,
+        }
+    };
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 4096;
+    config.task_stack_size = 4096;
+    config.task_priority = 5;
+    if (!vfs_create_uart(&uart_config, &config.vfs_config)) {
+        close(master);
+        return false;
+    }
+    auto dte = create_vfs_dte(&config);
+    if (!dte || !dte->set_mode(modem_mode::DATA_MODE)) {
+        close(master);
+        return false;
+    }
+    std::atomic<size_t> received{0};
+    std::atomic<size_t> wakeups{0};
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        received += len;
+        wakeups++;
+        return false;
+    });
+
+    // latency: short responses, one at a time
+    const int round_trips = 200;
+    uint8_t response[8] = { '\r', '\n', 'O', 'K', '\r', '\n', '\r', '\n' };
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < round_trips; ++i) {
+        size_t expected = received + sizeof(response);
+        if (write(master, response, sizeof(response)) != sizeof(response)) {
+            break;
+        }
+        while (received < expected) {
+            std::this_thread::yield();
+        }
+    }
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // bulk data written as fast as the pseudo terminal accepts them
+    const size_t total = 4 * 1024 * 1024;
+    std::vector<uint8_t> block(4096, 0x55);
+    received = 0;
+    wakeups = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < total;) {
+        ssize_t len = write(master, block.data(), block.size());
+        sent += len > 0 ? len : 0;
+    }
+    while (received < total) {
+        std::this_thread::yield();
+    }
+    auto bulk = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    size_t bulk_wakeups = wakeups;
+
+    // paced data, arriving in small pieces like from a real serial line (16 bytes per 100 us ~ 1.5 Mbaud)
+    const size_t paced = 64 * 1024;
+    received = 0;
+    wakeups = 0;
+    for (size_t sent = 0; sent < paced; sent += 16) {
+        if (write(master, block.data(), 16) != 16) {
+            break;
+        }
+        usleep(100);
+    }
+    while (received < paced) {
+        std::this_thread::yield();
+    }
+    printf("serial %-11s: response latency %.1f us, bulk %.1f MB/s, bytes per wake-up: bulk %.0f, paced %.0f\n", name,
+           static_cast<double>(latency) / round_trips, static_cast<double>(total) / bulk,
+           static_cast<double>(total) / bulk_wakeups, static_cast<double>(paced) / wakeups);
+    std::string key = std::string("serial/") + name;
+    report(key + "/response_latency", static_cast<double>(latency) / round_trips, "us");
+    report(key + "/bulk", static_cast<double>(total) / bulk, "MB/s");
+    report(key + "/bytes_per_wakeup_bulk", static_cast<double>(total) / bulk_wakeups, "B");
+    report(key + "/bytes_per_wakeup_paced", static_cast<double>(paced) / wakeups, "B");
+    dte.reset();
+    close(master);
+    return true;
+}
+
+static bool bench_modem_simulator(const char *name, const modem_simulator_config &modem_config)
+{
+    ModemSimulator modem(modem_config);
+    if (strlen(modem.device_name()) == 0) {
+        printf("Cannot open a pseudo terminal\n");
+        return false;
+    }
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = modem.device_name(),
+        .uart = {
+            .port_num = UART_NUM_1,
+            .data_bits = UART_DATA_8_BITS,
+            .stop_bits = UART_STOP_BITS_1,
+            .parity = UART_PARITY_DISABLE,
+            .flow_control = ESP_MODEM_FLOW_CONTROL_NONE,
+            .baud_rate = modem_config.baud_rate > 0 ? modem_config.baud_rate : 3000000,
+        }
+    };
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 4096;
+    config.task_stack_size = 4096;
+    config.task_priority = 5;
+    if (!vfs_create_uart(&uart_config, &config.vfs_config)) {
+        return false;
+    }
+    auto dte = create_vfs_dte(&config);
+    if (!dte || !dte->set_mode(modem_mode::COMMAND_MODE)) {
+        return false;
+    }
+    auto got_ok = [](std::string_view line) {
+        return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+    };
+
+    // command latency: one AT command at a time
+    const int commands = 50;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commands; ++i) {
+        if (dte->command("AT\r", got_ok, 1000) != command_result::OK) {
+            printf("Command failed\n");
+            return false;
+        }
+    }
+    auto command = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // PPP bring-up: dial, enter data mode and get the LCP Configure-Request acknowledged
+    std::atomic<size_t> received{0};
+    uint8_t lcp_request[] = { 0x7e, 0xff, 0x7d, 0x23, 0xc0, 0x21, 0x7d, 0x21, 0x7d, 0x21, 0x7d, 0x20, 0x7d, 0x24, 0xd1, 0xb5, 0x7e };
+    const size_t lcp_ack_len = 18;
+    start = std::chrono::steady_clock::now();
+    if (dce_commands::set_data_mode(dte.get()) != command_result::OK || !dte->set_mode(modem_mode::DATA_MODE)) {
+        printf("Dial failed\n");
+        return false;
+    }
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        received += len;
+        return false;
+    });
+    dte->write(lcp_request, sizeof(lcp_request));
+    while (received < lcp_ack_len) {
+        std::this_thread::yield();
+    }
+    auto bring_up = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (dce_commands::set_command_mode(dte.get()) != command_result::OK || !dte->set_mode(modem_mode::COMMAND_MODE)) {
+        printf("Escape from data mode failed\n");
+        return false;
+    }
+
+    // CMUX throughput: data looped back by the modem on the first DLCI
+    if (dce_commands::set_cmux(dte.get()) != command_result::OK || !dte->set_mode(modem_mode::CMUX_MODE) ||
+            dce_commands::set_data_mode(dte.get()) != command_result::OK || !dte->set_mode(modem_mode::DATA_MODE)) {
+        printf("CMUX setup failed\n");
+        return false;
+    }
+    received = 0;
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        received += len;
+        return false;
+    });
+    const size_t total = modem_config.baud_rate > 0 ? 64 * 1024 : 1024 * 1024;
+    std::vector<uint8_t> block(1024, 0x55);
+    start = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < total; sent += block.size()) {
+        while (dte->queued_bytes() > 4 * block.size()) {   // keep within the output queue of the terminal
+            std::this_thread::yield();
+        }
+        dte->write(block.data(), block.size());
+    }
+    while (received < total) {
+        std::this_thread::yield();
+    }
+    auto cmux = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("simulator %-16s: command latency %.1f us, PPP bring-up %.1f ms, CMUX loopback %.1f kB/s\n", name,
+           static_cast<double>(command) / commands, static_cast<double>(bring_up) / 1000,
+           static_cast<double>(total) * 1000 / cmux);
+    std::string key = std::string("simulator/") + name;
+    report(key + "/command_latency", static_cast<double>(command) / commands, "us");
+    report(key + "/ppp_bring_up", static_cast<double>(bring_up) / 1000, "ms");
+    report(key + "/cmux_loopback", static_cast<double>(total) * 1000 / cmux, "kB/s");
+    dte.reset();
+    return modem.frame_errors() == 0;
+}
+
+/**
+ * @brief Terminal standing for the modem in the in-process benchmarks
+ *
+ * Acknowledges SABM/DISC frames, counts and drops everything else written, and hands the injected data
+ * over the way the file descriptor terminals do (read callback without data, then read())
+ */
+class BenchTerm: public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        if (len == 6 && data[0] == 0xf9 && ((data[2] & ~0x10) == 0x2f || (data[2] & ~0x10) == 0x43)) {
+            uint8_t ua[] = { 0xf9, data[1], 0x73, 0x01, 0x00, 0xf9 };
+            ua[4] = cmux_fcs::calculate(ua + 1, 3);
+            feed(ua, sizeof(ua));
+        }
+        written += len;
+        return len;
+    }
+
+    int writev(const struct iovec *iov, size_t count) override
+    {
+        int total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += write(static_cast<uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+        }
+        return total;
+    }
+
+    int read(uint8_t *data, size_t len) override
+    {
+        size_t read_len = std::min(len, rx_len);
+        memcpy(data, rx_data, read_len);
+        rx_data += read_len;
+        rx_len -= read_len;
+        return read_len;
+    }
+
+    void feed(const uint8_t *data, size_t len)
+    {
+        rx_data = data;
+        rx_len = len;
+        while (rx_len > 0 && on_read) {
+            size_t before = rx_len;
+            on_read(nullptr, rx_len);
+            if (rx_len == before) {
+                break;
+            }
+        }
+        rx_len = 0;
+    }
+
+    void start() override {}
+    void stop() override {}
+
+    size_t written = 0;
+
+private:
+    const uint8_t *rx_data = nullptr;
+    size_t rx_len = 0;
+};
+
+/**
+ * @brief Terminal answering the commands right away with scripted responses
+ */
+class ScriptTerm: public Terminal {
+public:
+    explicit ScriptTerm(std::vector<std::pair<std::string, std::string>> s): script(std::move(s)) {}
+
+    int write(uint8_t *data, size_t len) override
+    {
+        std::string_view command(reinterpret_cast<char *>(data), len);
+        for (const auto &entry : script) {
+            if (command == entry.first) {
+                response = entry.second;
+                on_read(nullptr, response.size());
+                break;
+            }
+        }
+        return len;
+    }
+
+    int read(uint8_t *data, size_t len) override
+    {
+        size_t read_len = std::min(len, response.size());
+        memcpy(data, response.data(), read_len);
+        response.erase(0, read_len);
+        return read_len;
+    }
+
+    void start() override {}
+    void stop() override {}
+
+private:
+    std::vector<std::pair<std::string, std::string>> script;
+    std::string response;
+};
+
+static std::shared_ptr<CMux> create_bench_cmux(BenchTerm *&term)
+{
+    auto t = std::make_unique<BenchTerm>();
+    term = t.get();
+    const size_t buffer_size = 1024;
+    auto cmux = std::make_shared<CMux>(std::move(t), std::make_unique<uint8_t[]>(buffer_size), buffer_size);
+    if (!cmux->init()) {
+        printf("CMUX init failed\n");
+        return nullptr;
+    }
+    return cmux;
+}
+
+static bool bench_cmux_decode()
+{
+    BenchTerm *term;
+    auto cmux = create_bench_cmux(term);
+    if (!cmux) {
+        return false;
+    }
+    size_t received = 0;
+    cmux->set_read_cb(0, [&received](uint8_t *data, size_t len) {
+        received += len;
+        return false;
+    });
+    // stream of full basic option UIH frames of the first DLCI
+    const size_t payload = 127;
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; stream.size() < 256 * 1024; ++i) {
+        uint8_t header[] = { 0xf9, (1 << 2) | 0x03, 0xef, (payload << 1) | 0x01 };
+        stream.insert(stream.end(), header, header + sizeof(header));
+        for (size_t j = 0; j < payload; ++j) {
+            stream.push_back(static_cast<uint8_t>(i + j));
+        }
+        stream.push_back(cmux_fcs::calculate(header + 1, 3));
+        stream.push_back(0xf9);
+    }
+    size_t expected = stream.size() / (payload + 6) * payload;
+    for (size_t fragment : { 1, 16, 64, 512, 4096 }) {
+        const size_t rounds = fragment < 16 ? 2 : 16;
+        received = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < stream.size(); i += fragment) {
+                term->feed(&stream[i], std::min(fragment, stream.size() - i));
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (received != expected * rounds) {
+            printf("CMUX decoded %zu bytes instead of %zu\n", received, expected * rounds);
+            return false;
+        }
+        double mbps = static_cast<double>(stream.size()) * rounds * 1000 / ns;
+        printf("cmux decode fragment=%4zu: %.1f MB/s\n", fragment, mbps);
+        report("cmux_decode/fragment=" + std::to_string(fragment), mbps, "MB/s");
+    }
+    return cmux->fcs_error_count() == 0;
+}
+
+static bool bench_cmux_encode()
+{
+    BenchTerm *term;
+    auto cmux = create_bench_cmux(term);
+    if (!cmux) {
+        return false;
+    }
+    std::vector<uint8_t> data(1500, 0x55);
+    const size_t total = 16 * 1024 * 1024;
+    for (size_t len : { 16, 127, 1500 }) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t sent = 0; sent < total; sent += len) {
+            if (cmux->write(0, data.data(), len) != static_cast<int>(len)) {
+                printf("CMUX write failed\n");
+                return false;
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        double mbps = static_cast<double>(total) * 1000 / ns;
+        printf("cmux encode write=%4zu: %.1f MB/s\n", len, mbps);
+        report("cmux_encode/write=" + std::to_string(len), mbps, "MB/s");
+    }
+    return true;
+}
+
+static bool bench_command_loopback()
+{
+    auto dte = std::make_shared<DTE>(std::make_unique<LoopbackTerm>());
+    const int commands = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commands; ++i) {
+        auto ret = dte->command("AT\r", [](std::string_view line) {
+            return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+        }, 1000);
+        if (ret != command_result::OK) {
+            printf("Command failed\n");
+            return false;
+        }
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("command loopback: %.2f us per command\n", static_cast<double>(us) / commands);
+    report("command/loopback", static_cast<double>(us) / commands, "us");
+    return true;
+}
+
+template<typename F>
+static bool measure_parse(const char *name, int calls, F &&call)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i) {
+        if (call() != command_result::OK) {
+            printf("%s failed\n", name);
+            return false;
+        }
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("parse %-18s: %.0f ns per call\n", name, static_cast<double>(ns) / calls);
+    report(std::string("parse/") + name, static_cast<double>(ns) / calls, "ns");
+    return true;
+}
+
+static bool bench_parse()
+{
+    auto dte = std::make_shared<DTE>(std::make_unique<ScriptTerm>(std::vector<std::pair<std::string, std::string>> {
+        { "AT+CSQ\r", "\r\n+CSQ: 20,99\r\n\r\nOK\r\n" },
+        { "AT+CBC\r", "\r\n+CBC: 0,85,4100\r\n\r\nOK\r\n" },
+        { "AT+COPS?\r", "\r\n+COPS: 0,0,\"Operator\",7\r\n\r\nOK\r\n" },
+    }));
+    const int calls = 20000;
+    int rssi, ber, voltage, bcs, bcl;
+    std::string name;
+    return measure_parse("get_signal_quality", calls, [&] {
+        return dce_commands::get_signal_quality(dte.get(), rssi, ber);
+    }) && measure_parse("get_battery_status", calls, [&] {
+        return dce_commands::get_battery_status(dte.get(), voltage, bcs, bcl);
+    }) && measure_parse("get_operator_name", calls, [&] {
+        return dce_commands::get_operator_name(dte.get(), name);
+    });
+}
+
+static bool bench_netif()
+{
+    auto t = std::make_unique<BenchTerm>();
+    auto term = t.get();
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 1600;
+    auto dte = std::make_shared<DTE>(&config, std::move(t));
+    if (!dte->set_mode(modem_mode::DATA_MODE)) {
+        return false;
+    }
+    const size_t packet = 1500;
+    const int packets = 100000;
+    std::vector<uint8_t> data(packet, 0x55);
+
+    // transmit: the driver hooks of the interface down to the terminal
+    esp_netif_obj plain = {};
+    {
+        Netif netif(dte, &plain);
+        netif.start();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < packets; ++i) {
+            plain.transmit(plain.ctx, data.data(), packet);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (term->written != packet * packets) {
+            printf("Netif transmitted %zu bytes instead of %zu\n", term->written, packet * packets);
+            return false;
+        }
+        printf("netif transmit: %.0f ns per packet\n", static_cast<double>(ns) / packets);
+        report("netif/transmit", static_cast<double>(ns) / packets, "ns");
+    }
+
+    // receive: from the terminal to the PPP input of the Linux port, which needs its tun device
+    esp_netif_t *ppp = nullptr;
+    try {
+        esp_netif_config_t netif_config = { .dev_name = "/dev/net/tun", .if_name = "modem_bench" };
+        ppp = esp_netif_new(&netif_config);
+    } catch (const std::exception &e) {
+        ppp = nullptr;
+    }
+    if (ppp == nullptr) {
+        printf("netif receive: skipped, tun device not available\n");
+        return true;
+    }
+    {
+        Netif netif(dte, ppp);
+        netif.start();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < packets; ++i) {
+            term->feed(data.data(), packet);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("netif receive: %.0f ns per packet\n", static_cast<double>(ns) / packets);
+        report("netif/receive", static_cast<double>(ns) / packets, "ns");
+    }
+    esp_netif_destroy(ppp);
+    return true;
+}
+
+static bool bench_replay(const char *path, bool realtime)
+{
+    std::unique_ptr<ReplayTerminal> term;
+    try {
+        term = std::make_unique<ReplayTerminal>(path, realtime, 0);
+    } catch (const esp_err_exception &e) {
+        printf("Cannot load %s: %s\n", path, e.what());
+        return false;
+    }
+    auto replay = term.get();
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 4096;
+    auto dte = std::make_shared<DTE>(&config, std::move(term));
+    if (!dte->set_mode(modem_mode::COMMAND_MODE)) {
+        return false;
+    }
+    size_t lines = 0;   // the session is parsed as unsolicited lines, as no command runs
+    auto count = [&lines](std::string_view line) {
+        lines++;
+    };
+    dte->set_urc_cb("+", count);
+    dte->set_urc_cb("OK", count);
+    dte->set_urc_cb("ERROR", count);
+    auto start = std::chrono::steady_clock::now();
+    replay->start();
+    if (!replay->wait_until_done(600000)) {
+        printf("Replay did not finish\n");
+        return false;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("replay %s: %zu bytes (%zu result lines) in %.1f ms, %.1f MB/s\n", path, replay->read_bytes(), lines,
+           static_cast<double>(elapsed) / 1000, static_cast<double>(replay->read_bytes()) / (elapsed > 0 ? elapsed : 1));
+    const char *file = strrchr(path, '/');
+    report(std::string("replay/") + (file ? file + 1 : path), static_cast<double>(replay->read_bytes()) / (elapsed > 0 ? elapsed : 1), "MB/s");
+    return true;
+}
+
+static bool selected(const char *filter, const char *group)
+{
+    return filter == nullptr || strstr(group, filter) != nullptr;
+}
+
+/**
+ * @brief Runs the benchmarks: [--filter <group>] [--json <file>|-] [--replay <log> [--realtime]]
+ *
+ * Groups: fcs, escape, cmux_decode, cmux_encode, command, parse, netif, serial, simulator
+ */
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    const char *json = nullptr;
+    const char *replay = nullptr;
+    bool realtime = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else {
+            printf("Usage: %s [--filter <group>] [--json <file>|-] [--replay <log> [--realtime]]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (replay) {   // replay a recorded session through the DTE instead
+        return bench_replay(replay, realtime) && (json == nullptr || write_json(json)) ? 0 : 1;
+    }
+    for (size_t i = 0; i < 256; ++i) {  // sanity check the table against the reference
+        uint8_t b = i;
+        if (fcs_bitwise(&b, 1) != cmux_fcs::calculate(&b, 1)) {
+            printf("FCS table mismatch at %zu\n", i);
+            return 1;
+        }
+    }
+    if (selected(filter, "fcs")) {
+        bench_fcs();
+    }
+    if (selected(filter, "escape") && !bench_escape()) {
+        return 1;
+    }
+    if ((selected(filter, "cmux_decode") && !bench_cmux_decode()) ||
+            (selected(filter, "cmux_encode") && !bench_cmux_encode()) ||
+            (selected(filter, "command") && !bench_command_loopback()) ||
+            (selected(filter, "parse") && !bench_parse()) ||
+            (selected(filter, "netif") && !bench_netif())) {
+        return 1;
+    }
+    if (selected(filter, "serial") &&
+            (!bench_serial_profile("default", ESP_MODEM_SERIAL_LATENCY_DEFAULT) ||
+             !bench_serial_profile("low-latency", ESP_MODEM_SERIAL_LOW_LATENCY) ||
+             !bench_serial_profile("throughput", ESP_MODEM_SERIAL_THROUGHPUT))) {
+        return 1;
+    }
+    modem_simulator_config line = {};
+    line.baud_rate = 921600;
+    line.latency_us = 2000;
+    line.jitter_us = 1000;
+    if (selected(filter, "simulator") &&
+            (!bench_modem_simulator("pty-speed", modem_simulator_config()) ||
+             !bench_modem_simulator("921600-2ms-jitter", line))) {
+        return 1;
+    }
+    return json == nullptr || write_json(json) ? 0 : 1;
+}
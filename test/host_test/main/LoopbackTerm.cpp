@@ -3,6 +3,19 @@
 #include <cstring>
 #include "LoopbackTerm.h"
 
+uint8_t cmux_fcs(const uint8_t *header, size_t len)
+{
+    // Reference (bitwise) FCS over address, control and length fields
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= header[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xE0 : (crc >> 1);
+        }
+    }
+    return 0xFF - crc;
+}
+
 void LoopbackTerm::start()
 {
     status = status_t::STARTED;
@@ -29,8 +42,13 @@ int LoopbackTerm::write(uint8_t *data, size_t len)
         } else if (command.find("AT+CSQ\r") != std::string::npos) {
             response = "+CSQ: 123,456\n\r\nOK\r\n";
         } else if (command.find("AT+CBC\r") != std::string::npos) {
-            response = is_bg96 ? "+CBC: 1,2,123456V\r\r\n\r\nOK\r\n\n\r\n" :
-                       "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
+            if (!is_bg96) {
+                response = "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
+            } else if (battery_queries++ == 0) {
+                response = "+CBC: 1,2,123456V\r\r\n\r\nOK\r\n\n\r\n";
+            } else {    // multi-digit fields on the next queries
+                response = "+CBC: 10,85,4012V\r\r\n\r\nOK\r\n\n\r\n";
+            }
         } else if (command.find("AT+CPIN=1234\r") != std::string::npos) {
             response = "OK\r\n";
             pin_ok = true;
@@ -54,6 +72,15 @@ int LoopbackTerm::write(uint8_t *data, size_t len)
         } else if (data[2] == 0xef) { // Generic request
             data[2] = 0xff;         // generic reply
         }
+        // the reply header has changed, so we need to update its FCS
+        if (len >= 6) {
+            data[4] = cmux_fcs(data + 1);
+        } else {
+            pending_fcs = cmux_fcs(data + 1);   // footer comes in a separate write
+        }
+    } else if (len == 2 && data[1] == 0xf9 && pending_fcs) {
+        data[0] = *pending_fcs;
+        pending_fcs.reset();
     }
     loopback_data.resize(data_len + len);
     memcpy(&loopback_data[data_len], data, len);
@@ -76,8 +103,8 @@ int LoopbackTerm::read(uint8_t *data, size_t len)
     return read_len;
 }
 
-LoopbackTerm::LoopbackTerm(bool is_bg96): loopback_data(), data_len(0), pin_ok(false), is_bg96(is_bg96) {}
+LoopbackTerm::LoopbackTerm(bool is_bg96): loopback_data(), data_len(0), pin_ok(false), is_bg96(is_bg96), battery_queries(0) {}
 
-LoopbackTerm::LoopbackTerm(): loopback_data(), data_len(0), pin_ok(false), is_bg96(false) {}
+LoopbackTerm::LoopbackTerm(): loopback_data(), data_len(0), pin_ok(false), is_bg96(false), battery_queries(0) {}
 
 LoopbackTerm::~LoopbackTerm() = default;
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <optional>
 #include "cxx_include/esp_modem_api.hpp"
 #include "cxx_include/esp_modem_terminal.hpp"
 
 using namespace esp_modem;
 
+/**
+ * @brief Reference GSM 07.10 FCS of the CMUX frame header (address, control, length)
+ */
+uint8_t cmux_fcs(const uint8_t *header, size_t len = 3);
+
 class LoopbackTerm : public Terminal {
 public:
     explicit LoopbackTerm(bool is_bg96);
@@ -30,4 +36,6 @@ private:
     size_t data_len;
     bool pin_ok;
     bool is_bg96;
+    int battery_queries;
+    std::optional<uint8_t> pending_fcs;
 };
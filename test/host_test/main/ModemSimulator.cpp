@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "cmux_fcs.hpp"
+#include "ModemSimulator.h"
+
+using namespace esp_modem;
+
+namespace {
+
+constexpr uint8_t SOF_MARKER = 0xF9;
+constexpr uint8_t EA = 0x01;            /* Extension bit      */
+constexpr uint8_t CR = 0x02;            /* Command / Response */
+constexpr uint8_t PF = 0x10;            /* Poll / Final       */
+constexpr uint8_t FT_UI = 0x03;
+constexpr uint8_t FT_SABM = 0x2F;
+constexpr uint8_t FT_DISC = 0x43;
+constexpr uint8_t FT_UA = 0x63;
+constexpr uint8_t FT_UIH = 0xEF;
+constexpr uint8_t CMD_CLD = 0x60;       /* Multiplexer close down */
+constexpr size_t BASIC_FRAME_SIZE = 127;
+
+constexpr uint8_t PPP_FLAG = 0x7E;
+constexpr uint8_t PPP_ESCAPE = 0x7D;
+constexpr uint16_t PPP_GOOD_FCS = 0xF0B8;
+constexpr uint16_t PPP_LCP = 0xC021;
+constexpr uint16_t PPP_IPCP = 0x8021;
+constexpr uint8_t PPP_CONFIGURE_REQUEST = 1;
+constexpr uint8_t PPP_CONFIGURE_ACK = 2;
+
+uint16_t ppp_fcs(uint16_t fcs, const uint8_t *data, size_t len)
+{
+    while (len--) {
+        fcs ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            fcs = (fcs & 0x01) ? (fcs >> 1) ^ 0x8408 : (fcs >> 1);
+        }
+    }
+    return fcs;
+}
+
+bool starts_with(const std::string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+} // namespace
+
+ModemSimulator::ModemSimulator(const modem_simulator_config &cfg):
+    config(cfg), jitter(cfg.seed), echo(cfg.echo)
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        return;
+    }
+    name = ptsname(master);
+    // keep the slave open, so the line does not hang up between the DTE sessions
+    slave = open(name.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        name.clear();
+        return;
+    }
+    struct termios tty = {};
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+    running = true;
+    responder = std::thread([this] { run(); });
+}
+
+ModemSimulator::~ModemSimulator()
+{
+    running = false;
+    if (responder.joinable()) {
+        responder.join();
+    }
+    if (slave >= 0) {
+        close(slave);
+    }
+    if (master >= 0) {
+        close(master);
+    }
+}
+
+void ModemSimulator::set_response(const std::string &command, const std::string &response)
+{
+    std::lock_guard<std::mutex> l(script_lock);
+    script[command] = response;
+}
+
+void ModemSimulator::run()
+{
+    uint8_t buffer[1024];
+    while (running) {
+        struct pollfd p = { master, POLLIN, 0 };
+        if (poll(&p, 1, 10) <= 0 || !(p.revents & POLLIN)) {
+            continue;
+        }
+        ssize_t len = read(master, buffer, sizeof(buffer));
+        if (len <= 0) {
+            continue;
+        }
+        line_delay(rx_clock, len);
+        if (cmux) {
+            on_cmux(buffer, len);
+        } else {
+            process(line, -1, buffer, len);
+        }
+    }
+}
+
+void ModemSimulator::process(channel &ch, int dlci, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (ch.state == mode::DATA) {   // the rest of the data belongs to the data mode
+            on_data(ch, dlci, data + i, len - i);
+            return;
+        }
+        if (data[i] == '\r') {
+            std::string command;
+            command.swap(ch.command);
+            on_command(ch, dlci, command);
+        } else if (data[i] != '\n') {
+            ch.command.push_back(data[i]);
+            if (ch.command == "+++") {  // escape sequence while already in command mode
+                ch.command.clear();
+                reply(dlci, reinterpret_cast<const uint8_t *>("\r\nOK\r\n"), 6);
+            }
+        }
+    }
+}
+
+void ModemSimulator::on_command(channel &ch, int dlci, const std::string &command)
+{
+    if (command.empty()) {
+        return;
+    }
+    command_count++;
+    std::string response = echo ? command + "\r" : "";
+    bool scripted = false;
+    {
+        std::lock_guard<std::mutex> l(script_lock);
+        auto it = script.find(command);
+        if (it != script.end()) {
+            response += it->second;
+            scripted = true;
+        }
+    }
+    if (!scripted) {
+        if (command == "ATE0" || command == "ATE1") {
+            echo = command == "ATE1";
+            response += "\r\nOK\r\n";
+        } else if (starts_with(command, "ATD") || command == "ATO") {
+            response += "\r\nCONNECT\r\n";
+        } else if (starts_with(command, "AT+CMUX=")) {   // only the basic option is simulated
+            response += command == "AT+CMUX=0" && dlci < 0 ? "\r\nOK\r\n" : "\r\nERROR\r\n";
+        } else if (command == "AT+CPIN?") {
+            response += pin_ok ? "\r\n+CPIN: READY\r\n\r\nOK\r\n" : "\r\n+CPIN: SIM PIN\r\n\r\nOK\r\n";
+        } else if (starts_with(command, "AT+CPIN=")) {
+            pin_ok = true;
+            response += "\r\nOK\r\n";
+        } else if (command == "AT+CSQ") {
+            response += "\r\n+CSQ: 20,99\r\n\r\nOK\r\n";
+        } else if (command == "AT+CGMM") {
+            response += "\r\nSIMULATOR\r\n\r\nOK\r\n";
+        } else if (command == "AT+CGSN") {
+            response += "\r\n860000000000009\r\n\r\nOK\r\n";
+        } else if (command == "AT+CIMI") {
+            response += "\r\n230000000000009\r\n\r\nOK\r\n";
+        } else if (starts_with(command, "AT")) {
+            response += "\r\nOK\r\n";
+        } else {
+            response += "\r\nERROR\r\n";
+        }
+    }
+    reply(dlci, reinterpret_cast<const uint8_t *>(response.data()), response.size());
+    // mode transitions follow the actual (possibly scripted) result
+    if ((starts_with(command, "ATD") || command == "ATO") && response.find("CONNECT") != std::string::npos) {
+        ch.state = mode::DATA;
+        ch.ppp.clear();
+    } else if (command == "AT+CMUX=0" && dlci < 0 && response.find("OK") != std::string::npos) {
+        cmux = true;
+        cmux_rx.clear();
+    }
+}
+
+void ModemSimulator::on_data(channel &ch, int dlci, const uint8_t *data, size_t len)
+{
+    data_count += len;
+    if (len == 3 && ch.ppp.empty() && memcmp(data, "+++", 3) == 0) {
+        ch.state = mode::COMMAND;
+        reply(dlci, reinterpret_cast<const uint8_t *>("\r\nOK\r\n"), 6);
+        return;
+    }
+    if (ch.ppp.empty() && memchr(data, PPP_FLAG, len) == nullptr) {    // no framing, plain loopback
+        reply(dlci, data, len);
+        return;
+    }
+    ch.ppp.insert(ch.ppp.end(), data, data + len);
+    auto &buf = ch.ppp;
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        if (buf[pos] != PPP_FLAG) {     // data outside of frames are looped back as they are
+            auto next = std::find(buf.begin() + pos, buf.end(), PPP_FLAG) - buf.begin();
+            reply(dlci, &buf[pos], next - pos);
+            pos = next;
+            continue;
+        }
+        auto end = std::find(buf.begin() + pos + 1, buf.end(), PPP_FLAG) - buf.begin();
+        if (end == static_cast<ptrdiff_t>(buf.size())) {
+            break;      // wait for the rest of the frame
+        }
+        if (end > static_cast<ptrdiff_t>(pos) + 1) {
+            on_ppp_frame(dlci, &buf[pos], end + 1 - pos);
+            pos = end + 1;
+        } else {        // empty frame, the second flag opens the next one
+            pos = end;
+        }
+    }
+    buf.erase(buf.begin(), buf.begin() + pos);
+}
+
+void ModemSimulator::on_ppp_frame(int dlci, const uint8_t *frame, size_t len)
+{
+    std::vector<uint8_t> content;
+    for (size_t i = 1; i < len - 1; ++i) {
+        if (frame[i] == PPP_ESCAPE && i + 1 < len - 1) {
+            content.push_back(frame[++i] ^ 0x20);
+        } else {
+            content.push_back(frame[i]);
+        }
+    }
+    if (content.size() < 4 || ppp_fcs(0xFFFF, content.data(), content.size()) != PPP_GOOD_FCS) {
+        error_count++;
+        return;
+    }
+    size_t offset = (content[0] == 0xFF && content[1] == 0x03) ? 2 : 0;    // address and control field
+    if (content.size() < offset + 4 + 2) {
+        reply(dlci, frame, len);
+        return;
+    }
+    uint16_t protocol = (content[offset] << 8) | content[offset + 1];
+    if ((protocol != PPP_LCP && protocol != PPP_IPCP) || content[offset + 2] != PPP_CONFIGURE_REQUEST) {
+        reply(dlci, frame, len);    // loop back everything but the configuration
+        return;
+    }
+    // acknowledge the requested options as they are
+    content[offset + 2] = PPP_CONFIGURE_ACK;
+    uint16_t fcs = ~ppp_fcs(0xFFFF, content.data(), content.size() - 2);
+    content[content.size() - 2] = fcs & 0xFF;
+    content[content.size() - 1] = fcs >> 8;
+    std::vector<uint8_t> ack = { PPP_FLAG };
+    for (auto b : content) {
+        if (b < 0x20 || b == PPP_FLAG || b == PPP_ESCAPE) {
+            ack.push_back(PPP_ESCAPE);
+            b ^= 0x20;
+        }
+        ack.push_back(b);
+    }
+    ack.push_back(PPP_FLAG);
+    reply(dlci, ack.data(), ack.size());
+}
+
+void ModemSimulator::on_cmux(const uint8_t *data, size_t len)
+{
+    cmux_rx.insert(cmux_rx.end(), data, data + len);
+    auto &buf = cmux_rx;
+    size_t pos = 0;
+    while (cmux) {
+        while (pos < buf.size() && buf[pos] != SOF_MARKER) {
+            pos++;
+        }
+        while (pos + 1 < buf.size() && buf[pos + 1] == SOF_MARKER) {    // repeated flags
+            pos++;
+        }
+        if (buf.size() - pos < 4) {
+            break;
+        }
+        size_t header = (buf[pos + 3] & EA) ? 3 : 4;
+        if (buf.size() - pos < 1 + header) {
+            break;
+        }
+        size_t payload_len = buf[pos + 3] >> 1;
+        if (header == 4) {
+            payload_len |= buf[pos + 4] << 7;
+        }
+        size_t total = 1 + header + payload_len + 2;
+        if (buf.size() - pos < total) {
+            break;
+        }
+        if (buf[pos + total - 1] != SOF_MARKER ||
+                cmux_fcs::calculate(&buf[pos + 1], header) != buf[pos + 1 + header + payload_len]) {
+            error_count++;
+            pos++;
+            continue;
+        }
+        on_cmux_frame(buf[pos + 1], buf[pos + 2], &buf[pos + 1 + header], payload_len);
+        pos += total - 1;   // the closing flag may also open the next frame
+    }
+    if (!cmux) {            // multiplexer closed, the rest belongs to the plain line
+        pos = std::min(pos + 1, buf.size());
+        std::vector<uint8_t> rest(buf.begin() + pos, buf.end());
+        buf.clear();
+        process(line, -1, rest.data(), rest.size());
+        return;
+    }
+    buf.erase(buf.begin(), buf.begin() + pos);
+}
+
+void ModemSimulator::on_cmux_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len)
+{
+    int dlci = address >> 2;
+    switch (control & ~PF) {
+    case FT_SABM:
+        if (dlci > 0) {
+            dlcis[dlci] = channel();
+        }
+        respond_delay();
+        send_frame(address, FT_UA | PF, nullptr, 0);
+        break;
+    case FT_DISC:
+        respond_delay();
+        send_frame(address, FT_UA | PF, nullptr, 0);
+        if (dlci == 0) {
+            cmux = false;
+            dlcis.clear();
+        } else {
+            dlcis.erase(dlci);
+        }
+        break;
+    case FT_UIH:
+    case FT_UI:
+        if (dlci == 0) {
+            if (len < 2 || !(payload[0] & CR)) {
+                break;      // responses to our own commands are not expected
+            }
+            std::vector<uint8_t> response(payload, payload + len);
+            response[0] &= ~CR;
+            respond_delay();
+            send_frame(address, FT_UIH, response.data(), response.size());
+            if ((payload[0] & ~(EA | CR)) == CMD_CLD) {
+                cmux = false;
+                dlcis.clear();
+            }
+        } else if (auto it = dlcis.find(dlci); it != dlcis.end()) {
+            process(it->second, dlci, payload, len);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void ModemSimulator::reply(int dlci, const uint8_t *data, size_t len)
+{
+    respond_delay();
+    if (dlci < 0) {
+        send(data, len);
+        return;
+    }
+    for (size_t sent = 0; sent < len; sent += BASIC_FRAME_SIZE) {
+        send_frame((dlci << 2) | CR | EA, FT_UIH, data + sent, std::min(len - sent, BASIC_FRAME_SIZE));
+    }
+}
+
+void ModemSimulator::send_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len)
+{
+    std::vector<uint8_t> frame = { SOF_MARKER, address, control, static_cast<uint8_t>((len << 1) | EA) };
+    if (len > 0) {
+        frame.insert(frame.end(), payload, payload + len);
+    }
+    frame.push_back(cmux_fcs::calculate(&frame[1], 3));
+    frame.push_back(SOF_MARKER);
+    send(frame.data(), frame.size());
+}
+
+void ModemSimulator::send(const uint8_t *data, size_t len)
+{
+    // without the line emulation write at once, otherwise in pieces of about one millisecond
+    size_t chunk = config.baud_rate > 0 ? std::max<size_t>(1, config.baud_rate / 10 / 1000) : len;
+    while (len > 0) {
+        ssize_t written = write(master, data, std::min(chunk, len));
+        if (written <= 0) {
+            if (!running) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        line_delay(tx_clock, written);
+        data += written;
+        len -= written;
+    }
+}
+
+void ModemSimulator::respond_delay()
+{
+    uint32_t delay = config.latency_us;
+    if (config.jitter_us > 0) {
+        delay += jitter() % (config.jitter_us + 1);
+    }
+    if (delay > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+    }
+}
+
+void ModemSimulator::line_delay(std::chrono::steady_clock::time_point &clock, size_t len)
+{
+    if (config.baud_rate <= 0) {
+        return;
+    }
+    // bytes occupy the line back to back, each one taking 10 bit times
+    clock = std::max(clock, std::chrono::steady_clock::now()) +
+            std::chrono::nanoseconds(len * 10 * 1000000000ULL / config.baud_rate);
+    std::this_thread::sleep_until(clock);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Configuration of the simulated modem
+ */
+struct modem_simulator_config {
+    int baud_rate = 0;          /*!< Emulated line speed in bits per second (10 bits per byte), 0 runs at the speed of the pty */
+    uint32_t latency_us = 0;    /*!< Processing delay before each response */
+    uint32_t jitter_us = 0;     /*!< Maximum random delay added to the latency */
+    bool echo = false;          /*!< Initial state of the command echo (ATE1/ATE0) */
+    uint32_t seed = 1;          /*!< Seed of the jitter generator, to keep the runs reproducible */
+};
+
+/**
+ * @brief Modem simulator serving the master side of a pseudo terminal
+ *
+ * The slave side (device_name()) is opened with vfs_create_uart(), so that the DTE runs over the real
+ * file descriptor path. The simulator answers AT commands (built-in defaults, or scripted ones),
+ * enters data mode on ATD/ATO, where it acknowledges PPP LCP/IPCP Configure-Requests and loops back
+ * everything else until "+++", and switches to basic option CMUX on AT+CMUX=0, with its own
+ * command/data mode on each DLCI.
+ */
+class ModemSimulator {
+public:
+    explicit ModemSimulator(const modem_simulator_config &config = {});
+
+    ~ModemSimulator();
+
+    /**
+     * @brief Name of the slave device to open by the DTE, empty if the pseudo terminal is not available
+     */
+    const char *device_name() const
+    {
+        return name.c_str();
+    }
+
+    /**
+     * @brief Scripts the response to a command
+     *
+     * @param command Command without the terminating "\r", e.g. "AT+CSQ"
+     * @param response Complete response, e.g. "\r\n+CSQ: 10,99\r\n\r\nOK\r\n"
+     */
+    void set_response(const std::string &command, const std::string &response);
+
+    /**
+     * @brief Number of processed AT commands
+     */
+    size_t commands() const
+    {
+        return command_count;
+    }
+
+    /**
+     * @brief Number of bytes received in data mode
+     */
+    size_t data_received() const
+    {
+        return data_count;
+    }
+
+    /**
+     * @brief Number of CMUX and PPP frames dropped for a wrong FCS
+     */
+    size_t frame_errors() const
+    {
+        return error_count;
+    }
+
+private:
+    enum class mode {
+        COMMAND,
+        DATA,
+    };
+    struct channel {            /*!< Command/data state of the plain line or of one DLCI */
+        mode state = mode::COMMAND;
+        std::string command;
+        std::vector<uint8_t> ppp;
+    };
+
+    void run();
+    void process(channel &ch, int dlci, const uint8_t *data, size_t len);
+    void on_command(channel &ch, int dlci, const std::string &command);
+    void on_data(channel &ch, int dlci, const uint8_t *data, size_t len);
+    void on_ppp_frame(int dlci, const uint8_t *frame, size_t len);
+    void on_cmux(const uint8_t *data, size_t len);
+    void on_cmux_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len);
+    void reply(int dlci, const uint8_t *data, size_t len);
+    void send_frame(uint8_t address, uint8_t control, const uint8_t *payload, size_t len);
+    void send(const uint8_t *data, size_t len);
+    void respond_delay();
+    void line_delay(std::chrono::steady_clock::time_point &clock, size_t len);
+
+    modem_simulator_config config;
+    int master{-1};
+    int slave{-1};
+    std::string name;
+    std::thread responder;
+    std::atomic<bool> running{false};
+    std::mt19937 jitter;
+    std::mutex script_lock;
+    std::map<std::string, std::string> script;
+    bool echo;
+    bool pin_ok{false};
+    bool cmux{false};
+    channel line;
+    std::map<int, channel> dlcis;
+    std::vector<uint8_t> cmux_rx;
+    std::chrono::steady_clock::time_point rx_clock;
+    std::chrono::steady_clock::time_point tx_clock;
+    std::atomic<size_t> command_count{0};
+    std::atomic<size_t> data_count{0};
+    std::atomic<size_t> error_count{0};
+};
@@ -1,9 +1,26 @@
 #define CATCH_CONFIG_MAIN // This tells the catch header to generate a main
 #include <memory>
 #include <future>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <asm/termbits.h>
+#include <chrono>
 #include "catch.hpp"
 #include "cxx_include/esp_modem_api.hpp"
+#include "cxx_include/esp_modem_reactor.hpp"
+#include "cxx_include/esp_modem_recorder.hpp"
+#include "vfs_resource/vfs_create.hpp"
 #include "LoopbackTerm.h"
+#include "ModemSimulator.h"
 
 using namespace esp_modem;
 
@@ -25,6 +42,10 @@ TEST_CASE("DCE AT parser", "[esp_modem]")
     CHECK(milli_volt == 123456);
     CHECK(bcl == 1);
     CHECK(bcs == 2);
+    CHECK(dce->get_battery_status(milli_volt, bcl, bcs) == command_result::OK);
+    CHECK(milli_volt == 4012);
+    CHECK(bcl == 10);
+    CHECK(bcs == 85);
 
     int rssi, ber;
     CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
@@ -58,6 +79,273 @@ TEST_CASE("DTE send/receive command", "[esp_modem]")
     CHECK(ret == command_result::OK);
 }
 
+class ChunkedTerm : public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        writes++;
+        written.append(reinterpret_cast<char *>(data), len);
+        deliver();
+        return len;
+    }
+    void deliver()
+    {
+        for (pos = 0; pos < response.size();) {
+            auto before = pos;
+            on_read(nullptr, std::min(chunk, response.size() - pos));
+            if (pos == before) {    // the receiver stopped reading
+                break;
+            }
+        }
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        len = std::min(len, std::min(chunk, response.size() - pos));
+        memcpy(data, response.data() + pos, len);
+        pos += len;
+        return len;
+    }
+    void start() override {}
+    void stop() override {}
+    std::string response;
+    size_t chunk = 1;
+    size_t pos = 0;
+    std::atomic<size_t> writes{0};
+    std::string written;
+};
+
+TEST_CASE("DTE delivers response line by line", "[esp_modem]")
+{
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+
+    term_ptr->response = "+COPS: 0,0,\"Operator\"\r\n\r\n+CSQ: 12,34\r\nOK\r\n";
+    for (size_t chunk : { 1, 5, 64 }) {
+        term_ptr->chunk = chunk;
+        std::vector<std::string> lines;
+        auto ret = dte->command("AT\r", [&](std::string_view line) {
+            lines.emplace_back(line);
+            return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+        }, 1000);
+        CHECK(ret == command_result::OK);
+        REQUIRE(lines.size() == 3);
+        CHECK(lines[0] == "+COPS: 0,0,\"Operator\"");
+        CHECK(lines[1] == "+CSQ: 12,34");
+        CHECK(lines[2] == "OK");
+    }
+}
+
+TEST_CASE("DTE buffer overflow policies", "[esp_modem]")
+{
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    CHECK(dte->set_buffer_size(16));
+    term_ptr->chunk = 8;
+    term_ptr->response = "+CGMM: a rather long model name\r\nOK\r\n";
+    auto got_ok = [](uint8_t *data, size_t len) {
+        std::string_view response((char *)data, len);
+        return response.find("OK\r\n") != std::string_view::npos ? command_result::OK : command_result::TIMEOUT;
+    };
+
+    CHECK(dte->command("AT+CGMM\r", got_ok, 1000) == command_result::OK);
+    auto stats = dte->buffer_stats();
+    CHECK(stats.overflows > 0);
+    CHECK(stats.dropped > 0);
+    CHECK(stats.high_water <= 16);
+
+    std::string model;
+    auto get_model = [&](std::string_view line) {
+        if (line == "OK") {
+            return command_result::OK;
+        }
+        model = line;
+        return command_result::TIMEOUT;
+    };
+    CHECK(dte->command("AT+CGMM\r", get_model, 1000) == command_result::OK);
+    CHECK(model == "long model name");  // only the tail of the overlong line is kept
+
+    dte->set_overflow_policy(ESP_MODEM_DTE_OVERFLOW_FAIL);
+    CHECK(dte->command("AT+CGMM\r", got_ok, 1000) == command_result::BUFFER_OVERFLOW);
+    CHECK(dte->command("AT+CGMM\r", get_model, 1000) == command_result::BUFFER_OVERFLOW);
+
+    CHECK(dte->set_buffer_size(64));
+    CHECK(dte->command("AT+CGMM\r", got_ok, 1000) == command_result::OK);
+    CHECK(dte->command("AT+CGMM\r", get_model, 1000) == command_result::OK);
+    CHECK(model == "+CGMM: a rather long model name");
+}
+
+TEST_CASE("DTE coalesces data mode writes", "[esp_modem]")
+{
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 512;
+    config.tx_coalesce_size = 64;
+    config.tx_coalesce_latency_us = 50000;
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(&config, std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::DATA_MODE) == true);
+
+    uint8_t fragment[] = { 0x7e, 0xff, 0x7d, 0x23, 0xc0, 0x21 };
+    for (int i = 0; i < 10; ++i) {  // 60 bytes stay in the buffer
+        CHECK(dte->write(fragment, sizeof(fragment)) == sizeof(fragment));
+    }
+    CHECK(term_ptr->writes == 0);
+    CHECK(dte->write(fragment, sizeof(fragment)) == sizeof(fragment));  // doesn't fit -> flushes the previous 60 bytes
+    CHECK(term_ptr->writes == 1);
+    dte->flush();
+    CHECK(term_ptr->writes == 2);
+    CHECK(term_ptr->written.size() == 66);
+
+    CHECK(dte->write(fragment, sizeof(fragment)) == sizeof(fragment));
+    for (int i = 0; i < 500 && term_ptr->writes < 3; ++i) {  // flushed by the latency timer
+        usleep(1000);
+    }
+    CHECK(term_ptr->writes == 3);
+
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    CHECK(dte->write(fragment, sizeof(fragment)) == sizeof(fragment));  // not coalesced in command mode
+    CHECK(term_ptr->writes == 4);
+}
+
+TEST_CASE("DTE routes unsolicited result codes", "[esp_modem]")
+{
+    UrcTrie trie;
+    CHECK(trie.insert("+C", 1));
+    CHECK(trie.insert("+CREG:", 2));
+    CHECK(trie.match("+CREG: 1") == 2);
+    CHECK(trie.match("+CMTI: \"SM\",3") == 1);
+    CHECK(trie.match("RING") == UrcTrie::NO_MATCH);
+    CHECK(trie.find("+CREG") == UrcTrie::NO_MATCH);   // exact prefixes only
+    CHECK(trie.find("+CREG:") == 2);
+    CHECK(trie.remove("+CREG:"));
+    CHECK(trie.match("+CREG: 1") == 1);
+    CHECK(trie.find("+CREG:") == UrcTrie::NO_MATCH);
+
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    term_ptr->chunk = 5;
+    std::vector<std::string> creg, ring, lines;
+    CHECK(dte->set_urc_cb("+CREG:", [&](std::string_view line) {
+        creg.emplace_back(line);
+    }));
+    CHECK(dte->set_urc_cb("RING", [&](std::string_view line) {
+        ring.emplace_back(line);
+    }));
+
+    term_ptr->response = "\r\n+CREG: 0\r\n";  // idle
+    term_ptr->deliver();
+    REQUIRE(creg.size() == 1);
+    CHECK(creg[0] == "+CREG: 0");
+
+    auto collect = [&](std::string_view line) {
+        lines.emplace_back(line);
+        return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+    };
+    term_ptr->response = "RING\r\n+CREG: 1\r\n+CSQ: 12,34\r\nOK\r\n";   // URCs interleaved with the response
+    CHECK(dte->command("AT+CSQ\r", collect, 1000) == command_result::OK);
+    CHECK(ring.size() == 1);
+    CHECK(creg.size() == 2);
+    REQUIRE(lines.size() == 2);
+    CHECK(lines[0] == "+CSQ: 12,34");
+
+    lines.clear();
+    term_ptr->response = "+CREG: 0,1\r\nOK\r\n";    // solicited response
+    CHECK(dte->command("AT+CREG?\r", collect, 1000) == command_result::OK);
+    CHECK(creg.size() == 2);
+    REQUIRE(lines.size() == 2);
+    CHECK(lines[0] == "+CREG: 0,1");
+
+    std::string response;   // whole buffer commands (e.g. send_sms()) are routed as well
+    term_ptr->response = "+CREG: 5\r\nRING\r\n+CSQ: 1,2\r\nOK\r\n";
+    CHECK(dte->command("AT+CSQ\r", [&](uint8_t *data, size_t len) {
+        response.assign(reinterpret_cast<char *>(data), len);
+        return response.find("OK\r\n") != std::string::npos ? command_result::OK : command_result::TIMEOUT;
+    }, 1000) == command_result::OK);
+    CHECK(ring.size() == 2);
+    CHECK(creg.size() == 3);
+    CHECK(response == "+CSQ: 1,2\r\nOK\r\n");
+
+    CHECK(dte->set_urc_cb("RING", nullptr));
+    CHECK(dte->set_urc_cb("RING", nullptr) == false);
+    term_ptr->response = "RING\r\n";
+    term_ptr->deliver();
+    CHECK(ring.size() == 2);
+}
+
+TEST_CASE("DTE keeps the subscribers of overlapping URC prefixes apart", "[esp_modem]")
+{
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    term_ptr->chunk = 64;
+    std::vector<std::string> any_c, creg;
+    auto token = std::make_shared<int>(0);
+    CHECK(dte->set_urc_cb("+C", [&, token](std::string_view line) {
+        any_c.emplace_back(line);
+    }));
+    CHECK(dte->set_urc_cb("+CREG:", [&](std::string_view line) {
+        creg.emplace_back(line);
+    }));
+    term_ptr->response = "+CREG: 1\r\n+CMTI: \"SM\",3\r\n";
+    term_ptr->deliver();
+    REQUIRE(any_c.size() == 1);
+    CHECK(any_c[0] == "+CMTI: \"SM\",3");
+    REQUIRE(creg.size() == 1);
+    CHECK(creg[0] == "+CREG: 1");
+
+    CHECK(dte->set_urc_cb("+C", nullptr));
+    CHECK(token.use_count() == 1);  // the removed subscriber is released
+    term_ptr->deliver();
+    CHECK(any_c.size() == 1);
+    CHECK(creg.size() == 2);
+
+    std::vector<std::string> resubscribed;
+    CHECK(dte->set_urc_cb("+C", [&](std::string_view line) {
+        resubscribed.emplace_back(line);
+    }));
+    term_ptr->deliver();
+    CHECK(any_c.size() == 1);
+    REQUIRE(resubscribed.size() == 1);
+    CHECK(resubscribed[0] == "+CMTI: \"SM\",3");
+    CHECK(creg.size() == 3);
+}
+
+TEST_CASE("DTE queues asynchronous commands", "[esp_modem]")
+{
+    auto term = std::make_unique<ChunkedTerm>();
+    auto term_ptr = term.get();
+    auto dte =  std::make_unique<DTE>(std::move(term));
+    CHECK(dte->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
+    term_ptr->response = "+CSQ: 12,34\r\nOK\r\n";
+    term_ptr->chunk = 8;
+
+    std::vector<std::future<command_result>> results;
+    std::atomic<int> lines{0};
+    for (int i = 0; i < 8; ++i) {
+        results.push_back(dte->command_async("AT+CSQ\r", [&](std::string_view line) {
+            lines++;
+            return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+        }, 1000));
+    }
+    // the queue holds 8 commands by default, so the extra one might be rejected
+    auto extra = dte->command_async("AT\r", [](std::string_view line) {
+        return command_result::OK;
+    }, 1000);
+    for (auto &r : results) {
+        CHECK(r.get() == command_result::OK);
+    }
+    auto extra_result = extra.get();
+    CHECK((extra_result == command_result::OK || extra_result == command_result::FAIL));
+    CHECK(lines >= 16);
+}
+
 TEST_CASE("DCE commands", "[esp_modem]")
 {
     auto term = std::make_unique<LoopbackTerm>();
@@ -114,6 +402,32 @@ TEST_CASE("DCE modes", "[esp_modem]")
     CHECK(dce->set_mode(esp_modem::modem_mode::COMMAND_MODE) == true);
 }
 
+TEST_CASE("DCE switches to advanced CMUX through the module", "[esp_modem]")
+{
+    class AdvancedCmuxModule: public GenericModule {
+        using GenericModule::GenericModule;
+    public:
+        command_result set_cmux_advanced() override
+        {
+            ++advanced_calls;
+            return command_result::OK;
+        }
+        int advanced_calls = 0;
+    };
+
+    esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+    dte_config.cmux_config.option = ESP_MODEM_CMUX_ADVANCED_OPTION;
+    dte_config.cmux_config.connect_timeout_ms = 10;
+    auto dte = std::make_shared<DTE>(&dte_config, std::make_unique<LoopbackTerm>());
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto module = std::make_shared<AdvancedCmuxModule>(dte, &dce_config);
+    DCE_T<AdvancedCmuxModule> dce(dte, module, &netif);
+
+    dce.set_mode(modem_mode::CMUX_MODE);
+    CHECK(module->advanced_calls == 1);
+}
+
 TEST_CASE("DCE CMUX test", "[esp_modem]")
 {
     auto term = std::make_unique<LoopbackTerm>();
@@ -135,3 +449,1069 @@ TEST_CASE("DCE CMUX test", "[esp_modem]")
     }, 1000);
     CHECK(ret == command_result::OK);
 }
+
+class CMuxFrameTerm : public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        if (len == 6 && data[0] == 0xf9 && data[2] == 0x3f && data[1] == 0x0b && drop_sabm > 0) { // lose SABM of DLCI2
+            drop_sabm--;
+        } else if (len == 6 && data[0] == 0xf9 && (data[2] == 0x3f || data[2] == 0x53)) { // SABM/DISC -> reply with UA
+            uint8_t ua[] = { 0xf9, data[1], 0x73, 0x01, 0x00, 0xf9 };
+            ua[4] = cmux_fcs(ua + 1);
+            on_read(ua, sizeof(ua));
+        } else if (len == 12 && data[1] == 0x03 && data[4] == 0x13 && answer_test) { // TEST command -> echo
+            uint8_t test[12];
+            memcpy(test, data, len);
+            test[4] = 0x11;
+            on_read(test, len);
+        } else if (len == 16 && data[1] == 0x03 && data[4] == 0x43 && pn_frame_size) { // PN command -> reply
+            uint8_t pn[16] = { 0xf9, 0x03, 0xef, 0x15, 0x41, 0x11 };
+            memcpy(pn + 6, data + 6, 8);
+            pn[10] = pn_frame_size & 0xFF;
+            pn[11] = pn_frame_size >> 8;
+            pn[14] = cmux_fcs(pn + 1);
+            pn[15] = 0xf9;
+            on_read(pn, sizeof(pn));
+        }
+        last_frame.assign(data, data + len);
+        written += len;
+        return len;
+    }
+    int writev(const struct iovec *iov, size_t count) override
+    {
+        writev_calls++;
+        std::vector<uint8_t> gathered;
+        for (size_t i = 0; i < count; ++i) {
+            auto base = static_cast<uint8_t *>(iov[i].iov_base);
+            gathered.insert(gathered.end(), base, base + iov[i].iov_len);
+        }
+        if (on_writev) {
+            on_writev(gathered.data(), gathered.size());
+        }
+        return write(gathered.data(), gathered.size());
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        return 0;
+    }
+    void inject(uint8_t *data, size_t len)
+    {
+        on_read(data, len);
+    }
+    void start() override {}
+    void stop() override {}
+    std::atomic<size_t> written{0};
+    std::vector<uint8_t> last_frame;
+    size_t writev_calls = 0;
+    size_t pn_frame_size = 0;
+    size_t drop_sabm = 0;
+    std::atomic<bool> answer_test{true};
+    std::function<void(const uint8_t *data, size_t len)> on_writev;
+};
+
+/**
+ * @brief Calls f(dlci, payload_len) for each basic option frame of the written data
+ */
+static void for_each_frame(const uint8_t *data, size_t len, const std::function<void(int, size_t)> &f)
+{
+    size_t pos = 0;
+    while (pos + 6 <= len && data[pos] == 0xf9) {
+        size_t header = 4;
+        size_t payload = data[pos + 3] >> 1;
+        if (!(data[pos + 3] & 0x01)) {
+            payload |= data[pos + 4] << 7;
+            header = 5;
+        }
+        f(data[pos + 1] >> 2, payload);
+        pos += header + payload + 2;
+    }
+}
+
+TEST_CASE("CMUX FCS verification", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512);
+    REQUIRE(cmux->init() == true);
+
+    std::string received;
+    cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+        received.append((char *)data, len);
+        return false;
+    });
+    // UIH reply frame on DLCI1 with payload "OK\r\n"
+    uint8_t frame[] = { 0xf9, 0x05, 0xff, 0x09, 'O', 'K', '\r', '\n', 0x00, 0xf9 };
+    frame[8] = cmux_fcs(frame + 1);
+    term_ptr->inject(frame, sizeof(frame));
+    CHECK(received == "OK\r\n");
+    CHECK(cmux->fcs_error_count() == 0);
+
+    received.clear();
+    frame[8] ^= 0x01;   // corrupt the FCS
+    term_ptr->inject(frame, sizeof(frame));
+    CHECK(received.empty());
+    CHECK(cmux->fcs_error_count() == 1);
+
+    // corrupted header fragmented across two reads is detected as well
+    frame[8] ^= 0x01;
+    frame[2] = 0xef;
+    term_ptr->inject(frame, 3);
+    term_ptr->inject(frame + 3, sizeof(frame) - 3);
+    CHECK(received.empty());
+    CHECK(cmux->fcs_error_count() == 2);
+}
+
+TEST_CASE("CMUX gathers frames into one write", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512);
+    REQUIRE(cmux->init() == true);
+
+    std::vector<uint8_t> packet(1500);
+    term_ptr->written = 0;
+    term_ptr->writev_calls = 0;
+    CHECK(cmux->write(1, packet.data(), packet.size()) == 1500);
+    CHECK(term_ptr->writev_calls == 1);
+    CHECK(term_ptr->written == 1500 + 12 * 6); // 12 frames of 127 bytes max, 6 bytes overhead each
+    CHECK(cmux->tx_stats(1).requests == 1);
+    CHECK(cmux->tx_stats(0).requests == 0);
+}
+
+TEST_CASE("CMUX scheduler bounds the command latency", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512);
+    REQUIRE(cmux->init() == true);
+
+    std::vector<uint8_t> bulk(8192);
+    uint8_t command[] = "AT+CSQ\r";
+    std::atomic<bool> command_queued{false};
+    size_t data_before_command = 0;     // DLCI2 payload written after the command was queued
+    size_t writes_before_command = 0;
+    bool command_sent = false;
+    std::atomic<bool> hold_write{false};
+    term_ptr->on_writev = [&](const uint8_t *data, size_t len) {
+        bool queued = command_queued;
+        if (hold_write.exchange(false)) {   // keep this write in progress until the command gets queued
+            while (!command_queued) {
+                usleep(100);
+            }
+            usleep(20'000);
+        }
+        size_t bulk_sent = 0;
+        for_each_frame(data, len, [&](int dlci, size_t payload) {
+            if (dlci == 1) {
+                command_sent = true;
+            } else if (dlci == 2 && queued && !command_sent) {
+                bulk_sent += payload;
+            }
+        });
+        if (bulk_sent > 0) {
+            data_before_command += bulk_sent;
+            writes_before_command++;
+        }
+        usleep(2000);   // slow line
+    };
+    auto inject_fc = [&](bool flow_off) {   // FCOFF/FCON command
+        uint8_t frame[] = { 0xf9, 0x03, 0xef, 0x05, static_cast<uint8_t>(flow_off ? 0x33 : 0x53), 0x01, 0x00, 0xf9 };
+        frame[6] = cmux_fcs(frame + 1);
+        term_ptr->inject(frame, sizeof(frame));
+    };
+
+    // the command queued together with the bulk data is sent within the first quantum (512 bytes)
+    inject_fc(true);
+    std::thread data_writer([&] {
+        CHECK(cmux->write(1, bulk.data(), bulk.size()) == bulk.size());
+    });
+    usleep(20'000);
+    command_queued = true;
+    std::thread command_writer([&] {
+        CHECK(cmux->write(0, command, sizeof(command) - 1) == sizeof(command) - 1);
+    });
+    usleep(20'000);
+    inject_fc(false);
+    command_writer.join();
+    data_writer.join();
+    CHECK(command_sent);
+    CHECK(data_before_command <= 512);
+    auto stats = cmux->tx_stats(0);
+    CHECK(stats.requests == 1);
+    CHECK(stats.max_delay_us >= 10'000);    // waited for flow on
+    CHECK(stats.total_delay_us == stats.max_delay_us);
+
+    // the command queued during the bulk transfer waits for the write in progress only
+    command_queued = false;
+    command_sent = false;
+    data_before_command = 0;
+    writes_before_command = 0;
+    hold_write = true;
+    std::thread bulk_writer([&] {
+        CHECK(cmux->write(1, bulk.data(), bulk.size()) == bulk.size());
+    });
+    while (hold_write) {
+        usleep(100);
+    }
+    command_queued = true;
+    CHECK(cmux->write(0, command, sizeof(command) - 1) == sizeof(command) - 1);
+    bulk_writer.join();
+    CHECK(command_sent);
+    CHECK(writes_before_command == 0);
+    stats = cmux->tx_stats(0);
+    CHECK(stats.requests == 2);
+    CHECK(stats.total_delay_us > stats.max_delay_us);   // both commands waited
+}
+
+TEST_CASE("CMUX frame size negotiation", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    term_ptr->pn_frame_size = 1024;
+    esp_modem_cmux_config config = { .max_frame_size = 1500 };
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(4096), 4096, &config);
+    REQUIRE(cmux->init() == true);
+    CHECK(cmux->frame_size(0) == 1024);
+    CHECK(cmux->frame_size(1) == 1024);
+
+    std::vector<uint8_t> packet(1500);
+    term_ptr->written = 0;
+    CHECK(cmux->write(1, packet.data(), packet.size()) == 1500);
+    CHECK(term_ptr->written == 1500 + 2 * 7); // two frames with extended length header
+
+    std::string received;
+    cmux->set_read_cb(1, [&](uint8_t *data, size_t len) {
+        received.append((char *)data, len);
+        return false;
+    });
+    // UIH frame on DLCI2 with 300 bytes of payload, i.e. using two-byte length field
+    std::vector<uint8_t> frame = { 0xf9, 0x09, 0xff, (300 & 0x7F) << 1, 300 >> 7 };
+    frame.insert(frame.end(), 300, 'a');
+    frame.push_back(0);
+    frame.push_back(0xf9);
+    frame[305] = cmux_fcs(&frame[1], 4);
+    term_ptr->inject(frame.data(), 4);
+    term_ptr->inject(frame.data() + 4, frame.size() - 4);
+    CHECK(received == std::string(300, 'a'));
+    CHECK(cmux->fcs_error_count() == 0);
+}
+
+TEST_CASE("CMUX opens additional terminals", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    esp_modem_cmux_config config = { .max_frame_size = 0, .terminals_num = 4 };
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    REQUIRE(cmux->init() == true);
+    CHECK(cmux->terminals_num() == 4);
+
+    uint8_t data[] = "AT\r";
+    CHECK(cmux->write(2, data, 3) == 0);   // not opened yet
+    CHECK(cmux->open_terminal(2) == true);
+    CHECK(cmux->write(2, data, 3) == 3);
+    CHECK(cmux->open_terminal(4) == false); // out of range
+
+    std::string received;
+    cmux->set_read_cb(2, [&](uint8_t *data, size_t len) {
+        received.append((char *)data, len);
+        return false;
+    });
+    uint8_t frame[] = { 0xf9, 0x0d, 0xff, 0x05, 'O', 'K', 0x00, 0xf9 };   // UIH frame on DLCI3
+    frame[6] = cmux_fcs(frame + 1);
+    term_ptr->inject(frame, sizeof(frame));
+    CHECK(received == "OK");
+
+    CHECK(cmux->close_terminal(2) == true);
+    CHECK(cmux->write(2, data, 3) == 0);
+    CHECK(cmux->frame_size(4) == 0);    // out of range
+    CHECK(cmux->frame_size(-1) == 0);
+
+    term_ptr->inject(frame, sizeof(frame));     // dropped, nobody would read it
+    received.clear();
+    CHECK(cmux->open_terminal(2) == true);
+    cmux->set_read_cb(2, [&](uint8_t *data, size_t len) {
+        received.append((char *)data, len);
+        return false;
+    });
+    CHECK(received.empty());
+    term_ptr->inject(frame, sizeof(frame));
+    CHECK(received == "OK");
+}
+
+TEST_CASE("CMUX receive ring retains and wraps data", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    esp_modem_cmux_config config = { .max_frame_size = 0, .terminals_num = 0, .rx_buffer_size = 250 };
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    REQUIRE(cmux->init() == true);
+
+    auto inject = [&](char c, uint8_t len) {    // UIH frame on DLCI1
+        std::vector<uint8_t> frame = { 0xf9, 0x05, 0xff, static_cast<uint8_t>((len << 1) | 1) };
+        frame.insert(frame.end(), len, c);
+        frame.push_back(cmux_fcs(&frame[1]));
+        frame.push_back(0xf9);
+        term_ptr->inject(frame.data(), frame.size());
+    };
+    // no read callback: frames are kept in the ring
+    inject('a', 100);
+    inject('b', 100);
+    REQUIRE(term_ptr->last_frame.size() == 10);     // ring is getting full -> flow off (MSC with FC bit) sent
+    CHECK(term_ptr->last_frame[4] == 0x73);
+    CHECK(term_ptr->last_frame[6] == 0x07);
+    CHECK((term_ptr->last_frame[7] & 0x02) != 0);
+    inject('c', 100);   // doesn't fit
+    CHECK(cmux->rx_overflow_count() == 1);
+    uint8_t data[100];
+    CHECK(cmux->read(0, data, sizeof(data)) == 100);
+    CHECK(std::string((char *)data, 100) == std::string(100, 'a'));
+
+    inject('c', 100);   // wraps around the end of the ring
+    CHECK((term_ptr->last_frame[7] & 0x02) != 0);   // still flow off
+    std::vector<std::string> segments;
+    cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+        segments.emplace_back((char *)data, len);
+        return false;
+    });
+    // the retained data are posted and flow on is signalled without waiting for another frame
+    REQUIRE(segments.size() == 2);
+    CHECK(segments[0] + segments[1] == std::string(100, 'b') + std::string(100, 'c'));
+    REQUIRE(term_ptr->last_frame.size() == 10);
+    CHECK(term_ptr->last_frame[4] == 0x73);
+    CHECK((term_ptr->last_frame[7] & 0x02) == 0);
+    inject('d', 40);
+    REQUIRE(segments.size() == 3);
+    CHECK(segments[2] == std::string(40, 'd'));
+    CHECK(cmux->rx_overflow_count() == 1);
+    CHECK(cmux->read(0, data, sizeof(data)) == 0);
+
+    // without a reader, the data are dropped and the modem isn't stopped
+    cmux->set_read_cb(0, nullptr);
+    size_t written = term_ptr->written;
+    inject('e', 100);
+    inject('f', 100);
+    inject('g', 100);
+    CHECK(term_ptr->written == written);
+    CHECK(cmux->rx_overflow_count() == 1);
+    CHECK(cmux->read(0, data, sizeof(data)) == 0);
+    inject('h', 100);   // retained again once read
+    CHECK(cmux->read(0, data, sizeof(data)) == 100);
+    CHECK(segments.size() == 3);
+}
+
+TEST_CASE("CMUX startup retries unacknowledged SABM", "[esp_modem]")
+{
+    esp_modem_cmux_config config = { .max_frame_size = 0, .terminals_num = 0, .rx_buffer_size = 0,
+                                     .connect_timeout_ms = 20, .connect_retries = 1
+                                   };
+    auto term = std::make_unique<CMuxFrameTerm>();
+    term->drop_sabm = 1;
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    CHECK(cmux->init() == true);
+
+    config.connect_retries = 0;
+    term = std::make_unique<CMuxFrameTerm>();
+    term->drop_sabm = 1;
+    cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    CHECK(cmux->init() == false);
+}
+
+TEST_CASE("CMUX flow control stops writing", "[esp_modem]")
+{
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512);
+    REQUIRE(cmux->init() == true);
+
+    auto inject_msc = [&](bool flow_off) {  // MSC command for DLCI2
+        uint8_t frame[] = { 0xf9, 0x03, 0xef, 0x09, 0x73, 0x05, 0x0b, static_cast<uint8_t>(flow_off ? 0x8f : 0x8d), 0x00, 0xf9 };
+        frame[8] = cmux_fcs(frame + 1);
+        term_ptr->inject(frame, sizeof(frame));
+    };
+    inject_msc(true);
+    CHECK(cmux->tx_stopped(1) == true);
+    CHECK(cmux->tx_stopped(0) == false);
+    REQUIRE(term_ptr->last_frame.size() == 10);
+    CHECK(term_ptr->last_frame[4] == 0x71);     // MSC response
+
+    uint8_t data[] = "data";
+    size_t written = term_ptr->written;
+    std::thread writer([&] {
+        CHECK(cmux->write(1, data, 4) == 4);
+    });
+    usleep(50'000);
+    CHECK(term_ptr->written == written);
+    CHECK(cmux->write(0, data, 4) == 4);        // other terminals are not affected
+    inject_msc(false);
+    writer.join();
+    CHECK(cmux->tx_stopped(1) == false);
+    CHECK(term_ptr->written == written + 10 + 2 * (4 + 6));
+
+    // the stopped writer gives up when the terminal gets closed
+    inject_msc(true);
+    auto stopped = std::async(std::launch::async, [&] {
+        return cmux->write(1, data, 4);
+    });
+    CHECK(stopped.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    CHECK(cmux->close_terminal(1) == true);
+    REQUIRE(stopped.wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+    CHECK(stopped.get() == -1);
+    CHECK(cmux->open_terminal(1) == true);      // nothing is left over in the queue
+    CHECK(cmux->write(1, data, 4) == 4);
+}
+
+TEST_CASE("CMUX keep-alive detects link down", "[esp_modem]")
+{
+    esp_modem_cmux_config config = { .max_frame_size = 0, .terminals_num = 0, .rx_buffer_size = 0,
+                                     .connect_timeout_ms = 0, .connect_retries = 0,
+                                     .keepalive_interval_ms = 5, .keepalive_timeout_ms = 20, .keepalive_max_misses = 2
+                                   };
+    auto term = std::make_unique<CMuxFrameTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    std::promise<void> link_down;
+    cmux->set_link_down_cb([&] {
+        link_down.set_value();
+    });
+    REQUIRE(cmux->init() == true);
+    usleep(50'000);
+    auto stats = cmux->keepalive_stats();
+    CHECK(stats.received > 0);
+    CHECK(stats.lost == 0);
+    CHECK(stats.rtt_histogram[0] > 0);
+
+    uint8_t msc[] = { 0xf9, 0x03, 0xef, 0x09, 0x73, 0x05, 0x0b, 0x8f, 0x00, 0xf9 };    // flow off of DLCI2
+    msc[8] = cmux_fcs(msc + 1);
+    term_ptr->inject(msc, sizeof(msc));
+    uint8_t data[] = "data";
+    auto stopped = std::async(std::launch::async, [&] {
+        return cmux->write(1, data, 4);
+    });
+    term_ptr->answer_test = false;
+    CHECK(link_down.get_future().wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+    CHECK(cmux->keepalive_stats().lost >= 2);
+    REQUIRE(stopped.wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+    CHECK(stopped.get() == -1);     // the stopped writer gives up on link down
+}
+
+class CMuxAdvancedTerm : public Terminal {
+public:
+    static std::vector<uint8_t> frame(uint8_t address, uint8_t control, const std::string &info)
+    {
+        uint8_t header[2] = { address, control };
+        std::vector<uint8_t> raw(header, header + 2);
+        raw.insert(raw.end(), info.begin(), info.end());
+        raw.push_back(cmux_fcs(header, 2));
+        std::vector<uint8_t> escaped = { 0x7e };
+        for (auto b : raw) {
+            if (b == 0x7e || b == 0x7d) {
+                escaped.push_back(0x7d);
+                b ^= 0x20;
+            }
+            escaped.push_back(b);
+        }
+        escaped.push_back(0x7e);
+        return escaped;
+    }
+    int write(uint8_t *data, size_t len) override
+    {
+        for (size_t i = 0; i < len; ++i) {
+            if (data[i] == 0x7e) {
+                if (current.size() >= 3) {
+                    on_frame();
+                }
+                current.clear();
+            } else if (data[i] == 0x7d) {
+                current.push_back(data[++i] ^ 0x20);
+            } else {
+                current.push_back(data[i]);
+            }
+        }
+        return len;
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        return 0;
+    }
+    void inject(uint8_t *data, size_t len)
+    {
+        on_read(data, len);
+    }
+    void start() override {}
+    void stop() override {}
+    std::string received;   // payload of data frames
+private:
+    void on_frame()
+    {
+        uint8_t fcs = current.back();
+        current.pop_back();
+        CHECK(fcs == cmux_fcs(current.data(), 2));
+        if (current[1] == 0x3f || current[1] == 0x53) {  // SABM/DISC -> reply with UA
+            auto ua = frame(current[0], 0x73, "");
+            on_read(ua.data(), ua.size());
+        } else if ((current[0] >> 2) > 0) {
+            received.append((char *)current.data() + 2, current.size() - 2);
+        }
+    }
+    std::vector<uint8_t> current;
+};
+
+TEST_CASE("CMUX advanced option framing", "[esp_modem]")
+{
+    esp_modem_cmux_config config = { .max_frame_size = 0, .terminals_num = 0, .rx_buffer_size = 0,
+                                     .connect_timeout_ms = 0, .connect_retries = 0,
+                                     .keepalive_interval_ms = 0, .keepalive_timeout_ms = 0, .keepalive_max_misses = 0,
+                                     .option = ESP_MODEM_CMUX_ADVANCED_OPTION
+                                   };
+    auto term = std::make_unique<CMuxAdvancedTerm>();
+    auto term_ptr = term.get();
+    auto cmux = std::make_shared<CMux>(std::move(term), std::make_unique<uint8_t[]>(512), 512, &config);
+    REQUIRE(cmux->init() == true);
+
+    std::string payload;
+    for (int i = 0; i < 600; ++i) {
+        payload.push_back(static_cast<char>(i % 7 ? i : 0x7e - i % 2));    // plenty of flags and escapes
+    }
+    CHECK(cmux->write(1, (uint8_t *)payload.data(), payload.size()) == 600);
+    CHECK(term_ptr->received == payload);
+
+    std::string received;
+    cmux->set_read_cb(0, [&](uint8_t *data, size_t len) {
+        received.append((char *)data, len);
+        return false;
+    });
+    auto frame = CMuxAdvancedTerm::frame(0x05, 0xef, payload.substr(0, 100));
+    for (size_t i = 0; i < frame.size(); i += 3) {  // fed in small chunks, splitting the escape sequences
+        term_ptr->inject(frame.data() + i, std::min<size_t>(3, frame.size() - i));
+    }
+    CHECK(received == payload.substr(0, 100));
+    CHECK(cmux->fcs_error_count() == 0);
+
+    frame[frame.size() - 2] ^= 0x01;    // corrupt the FCS
+    term_ptr->inject(frame.data(), frame.size());
+    CHECK(received == payload.substr(0, 100));
+    CHECK(cmux->fcs_error_count() == 1);
+}
+
+TEST_CASE("FdTerminals share one reactor", "[esp_modem]")
+{
+    constexpr int terminals = 4;
+    esp_modem_reactor reactor(1);
+    int peers[terminals];
+    std::shared_ptr<DTE> dtes[terminals];
+    std::atomic<size_t> received[terminals] = {};
+    for (int i = 0; i < terminals; ++i) {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        peers[i] = sv[1];
+        esp_modem_dte_config_t config = {};
+        config.dte_buffer_size = 512;
+        config.vfs_config.fd = sv[0];
+        config.vfs_config.deleter = [](int fd, struct esp_modem_vfs_resource *) {
+            close(fd);
+        };
+        config.vfs_config.reactor = &reactor;
+        dtes[i] = create_vfs_dte(&config);
+        REQUIRE(dtes[i] != nullptr);
+        CHECK(dtes[i]->set_mode(modem_mode::DATA_MODE));
+        dtes[i]->set_read_cb([&received, i](uint8_t *data, size_t len) {
+            received[i] += len;
+            return false;
+        });
+    }
+    for (int i = 0; i < terminals; ++i) {
+        CHECK(write(peers[i], "0123456789", i + 1) == i + 1);
+    }
+    for (int wait = 0; wait < 1000; ++wait) {
+        bool all = true;
+        for (int i = 0; i < terminals; ++i) {
+            all = all && received[i] == static_cast<size_t>(i + 1);
+        }
+        if (all) {
+            break;
+        }
+        usleep(1000);
+    }
+    for (int i = 0; i < terminals; ++i) {
+        CHECK(received[i] == static_cast<size_t>(i + 1));
+    }
+
+    // data waiting for a command are delivered as soon as the command sets its callback
+    CHECK(dtes[0]->set_mode(modem_mode::COMMAND_MODE));
+    auto got_ok = [](std::string_view line) {
+        return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+    };
+    CHECK(dtes[0]->command("AT\r", got_ok, 50) == command_result::TIMEOUT);  // no answer, clears the callback
+    CHECK(write(peers[0], "OK\r\n", 4) == 4);
+    usleep(10000);
+    CHECK(dtes[0]->command("AT\r", got_ok, 1000) == command_result::OK);
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &dte : dtes) {
+        dte.reset();
+    }
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+    for (auto peer : peers) {
+        close(peer);
+    }
+}
+
+TEST_CASE("io_uring terminal", "[esp_modem]")
+{
+    int sv[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 512;
+    config.vfs_config.fd = sv[0];
+    config.vfs_config.deleter = [](int fd, struct esp_modem_vfs_resource *) {
+        close(fd);
+    };
+    config.vfs_config.io_backend = ESP_MODEM_VFS_IO_URING;
+    auto dte = create_vfs_dte(&config);
+    REQUIRE(dte != nullptr);
+    CHECK(dte->set_mode(modem_mode::COMMAND_MODE));
+
+    std::thread modem([peer = sv[1]] {    // answers one command
+        char cmd[16];
+        if (read(peer, cmd, sizeof(cmd)) > 0) {
+            CHECK(write(peer, "\r\n+CSQ: 12,34\r\n\r\nOK\r\n", 21) == 21);
+        }
+    });
+    std::string out;
+    auto ret = dte->command("AT+CSQ\r", [&](std::string_view line) {
+        if (line == "OK") {
+            return command_result::OK;
+        }
+        out = line;
+        return command_result::TIMEOUT;
+    }, 1000);
+    modem.join();
+    CHECK(ret == command_result::OK);
+    CHECK(out == "+CSQ: 12,34");
+
+    CHECK(dte->set_mode(modem_mode::DATA_MODE));
+    std::atomic<size_t> received{0};
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        received += len;
+        return false;
+    });
+    std::vector<uint8_t> payload(10000, 0x55);
+    CHECK(write(sv[1], payload.data(), payload.size()) == static_cast<ssize_t>(payload.size()));
+    for (int i = 0; i < 1000 && received < payload.size(); ++i) {
+        usleep(1000);
+    }
+    CHECK(received == payload.size());
+
+    uint8_t out_data[] = "~data~";
+    CHECK(dte->write(out_data, 6) == 6);
+    char echo[8];
+    CHECK(read(sv[1], echo, sizeof(echo)) == 6);
+    dte.reset();
+    close(sv[1]);
+}
+
+TEST_CASE("FdTerminal queues data while the output would block", "[esp_modem]")
+{
+    for (bool use_reactor : { false, true }) {
+        esp_modem_reactor reactor(1);
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+        esp_modem_dte_config_t config = {};
+        config.dte_buffer_size = 512;
+        config.vfs_config.fd = sv[0];
+        config.vfs_config.deleter = [](int fd, struct esp_modem_vfs_resource *) {
+            close(fd);
+        };
+        config.vfs_config.reactor = use_reactor ? &reactor : nullptr;
+        config.vfs_config.tx_queue_size = 4096;
+        auto dte = create_vfs_dte(&config);
+        REQUIRE(dte != nullptr);
+        CHECK(dte->set_mode(modem_mode::DATA_MODE));
+        std::atomic<int> writable{0};
+        dte->set_writable_cb([&writable] {
+            writable++;
+        });
+
+        // fill the socket buffer and the queue, the data carry a running counter to check the order
+        std::vector<uint8_t> chunk(1000);
+        size_t accepted = 0;
+        while (true) {
+            for (size_t i = 0; i < chunk.size(); ++i) {
+                chunk[i] = static_cast<uint8_t>(accepted + i);
+            }
+            int len = dte->write(chunk.data(), chunk.size());
+            accepted += len;
+            if (len < static_cast<int>(chunk.size())) {
+                break;
+            }
+        }
+        CHECK(dte->queued_bytes() == 4096);
+        CHECK(writable == 0);
+
+        size_t received = 0;
+        bool in_order = true;
+        uint8_t buf[1024];
+        for (int wait = 0; wait < 1000 && received < accepted; ++wait) {
+            ssize_t len = read(sv[1], buf, sizeof(buf));
+            if (len <= 0) {
+                usleep(1000);
+                continue;
+            }
+            for (ssize_t i = 0; i < len; ++i) {
+                in_order = in_order && buf[i] == static_cast<uint8_t>(received + i);
+            }
+            received += len;
+        }
+        CHECK(received == accepted);
+        CHECK(in_order);
+        for (int wait = 0; wait < 1000 && writable == 0; ++wait) {
+            usleep(1000);
+        }
+        CHECK(writable == 1);
+        CHECK(dte->queued_bytes() == 0);
+        dte.reset();
+        close(sv[1]);
+    }
+}
+
+TEST_CASE("VFS UART applies the line settings", "[esp_modem]")
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    REQUIRE(master >= 0);
+    REQUIRE(grantpt(master) == 0);
+    REQUIRE(unlockpt(master) == 0);
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = ptsname(master),
+        .uart = {
+            .port_num = UART_NUM_1,
+            .data_bits = UART_DATA_8_BITS,
+            .stop_bits = UART_STOP_BITS_2,
+            .parity = UART_PARITY_DISABLE,  // pseudo terminals do not keep the parity
+            .flow_control = ESP_MODEM_FLOW_CONTROL_HW,
+            .baud_rate = 921600,
+        }
+    };
+    esp_modem_dte_config_t config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+    struct esp_modem_vfs_uart_creator not_tty = uart_config;
+    not_tty.dev_name = "/dev/null";
+    int next_fd = dup(master);
+    close(next_fd);
+    CHECK(vfs_create_uart(&not_tty, &config.vfs_config) == false);  // the line settings can't be applied
+    int fd_after = dup(master);
+    close(fd_after);
+    CHECK(fd_after == next_fd);     // the opened fd is closed
+    REQUIRE(vfs_create_uart(&uart_config, &config.vfs_config));
+    CHECK(config.vfs_config.reactor == nullptr);    // not left over from the UART config
+    int fd = config.vfs_config.fd;
+    auto dte = create_vfs_dte(&config);
+    REQUIRE(dte != nullptr);
+
+    struct termios2 tty = {};
+    REQUIRE(ioctl(fd, TCGETS2, &tty) == 0);
+    CHECK(tty.c_ospeed == 921600);
+    CHECK((tty.c_cflag & CSIZE) == CS8);
+    CHECK((tty.c_cflag & CSTOPB) != 0);
+    CHECK((tty.c_cflag & CRTSCTS) != 0);
+
+    CHECK(dte->set_baud_rate(3000000));
+    REQUIRE(ioctl(fd, TCGETS2, &tty) == 0);
+    CHECK(tty.c_ospeed == 3000000);
+    CHECK(tty.c_ispeed == 3000000);
+    dte.reset();
+    close(master);
+}
+
+TEST_CASE("VFS UART throughput profile picks up short responses", "[esp_modem]")
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    REQUIRE(master >= 0);
+    REQUIRE(grantpt(master) == 0);
+    REQUIRE(unlockpt(master) == 0);
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = ptsname(master),
+        .uart = {
+            .port_num = UART_NUM_1,
+            .data_bits = UART_DATA_8_BITS,
+            .stop_bits = UART_STOP_BITS_1,
+            .parity = UART_PARITY_DISABLE,
+            .flow_control = ESP_MODEM_FLOW_CONTROL_NONE,
+            .baud_rate = 115200,
+            .latency_profile = ESP_MODEM_SERIAL_THROUGHPUT,
+        }
+    };
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 512;
+    REQUIRE(vfs_create_uart(&uart_config, &config.vfs_config));
+    CHECK(config.vfs_config.read_poll_ms > 0);
+    struct termios2 tty = {};
+    REQUIRE(ioctl(config.vfs_config.fd, TCGETS2, &tty) == 0);
+    CHECK(tty.c_cc[VMIN] > 1);
+    auto dte = create_vfs_dte(&config);
+    REQUIRE(dte != nullptr);
+    CHECK(dte->set_mode(modem_mode::COMMAND_MODE));
+
+    std::thread modem([master] {    // answers one command with less data than the wake-up threshold
+        char cmd[16];
+        for (int i = 0; i < 1000; ++i) {
+            if (read(master, cmd, sizeof(cmd)) > 0) {
+                CHECK(write(master, "\r\nOK\r\n", 6) == 6);
+                return;
+            }
+            usleep(1000);
+        }
+    });
+    auto ret = dte->command("AT\r", [&](std::string_view line) {
+        return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+    }, 1000);
+    modem.join();
+    CHECK(ret == command_result::OK);
+    dte.reset();
+    close(master);
+}
+
+TEST_CASE("VFS socket endpoints and reconnection", "[esp_modem]")
+{
+    auto answer_ok = [](int peer) {     // modem answering one command
+        char cmd[16];
+        for (int i = 0; i < 1000; ++i) {
+            if (read(peer, cmd, sizeof(cmd)) > 0) {
+                CHECK(write(peer, "\r\nOK\r\n", 6) == 6);
+                return;
+            }
+            usleep(1000);
+        }
+    };
+    auto got_ok = [](std::string_view line) {
+        return line == "OK" ? command_result::OK : command_result::TIMEOUT;
+    };
+
+    SECTION("Unix domain socket reconnects") {
+        std::string path = "/tmp/esp_modem_test_" + std::to_string(getpid()) + ".sock";
+        unlink(path.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        REQUIRE(listener >= 0);
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        REQUIRE(bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0);
+        REQUIRE(listen(listener, 1) == 0);
+
+        std::string endpoint = "unix:" + path;
+        struct esp_modem_vfs_socket_creator socket_config = {
+            .host_name = endpoint.c_str(),
+            .port = 0,
+            .rcvbuf_size = 0,
+            .sndbuf_size = 0,
+            .reconnect_min_ms = 10,
+            .reconnect_max_ms = 100,
+        };
+        esp_modem_dte_config_t config = {};
+        config.dte_buffer_size = 512;
+        REQUIRE(vfs_create_socket(&socket_config, &config.vfs_config));
+        auto dte = create_vfs_dte(&config);
+        REQUIRE(dte != nullptr);
+        CHECK(dte->set_mode(modem_mode::COMMAND_MODE));
+
+        int peer = accept(listener, nullptr, nullptr);
+        REQUIRE(peer >= 0);
+        std::thread modem(answer_ok, peer);
+        CHECK(dte->command("AT\r", got_ok, 1000) == command_result::OK);
+        modem.join();
+
+        close(peer);    // connection dropped by the remote end
+        peer = accept(listener, nullptr, nullptr);
+        REQUIRE(peer >= 0);
+        usleep(10000);  // the terminal switches to the new connection
+        modem = std::thread(answer_ok, peer);
+        CHECK(dte->command("AT\r", got_ok, 1000) == command_result::OK);
+        modem.join();
+
+        dte.reset();
+        close(peer);
+        close(listener);
+        unlink(path.c_str());
+    }
+
+    SECTION("IPv6 with TCP_NODELAY") {
+        int listener = socket(AF_INET6, SOCK_STREAM, 0);
+        struct sockaddr_in6 address = {};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_loopback;
+        socklen_t address_len = sizeof(address);
+        if (listener < 0 || bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+            WARN("IPv6 loopback not available");
+            if (listener >= 0) {
+                close(listener);
+            }
+            return;
+        }
+        REQUIRE(listen(listener, 1) == 0);
+        REQUIRE(getsockname(listener, reinterpret_cast<struct sockaddr *>(&address), &address_len) == 0);
+
+        struct esp_modem_vfs_socket_creator socket_config = {
+            .host_name = "::1",
+            .port = ntohs(address.sin6_port),
+            .rcvbuf_size = 16384,
+            .sndbuf_size = 16384,
+            .reconnect_min_ms = 0,
+            .reconnect_max_ms = 0,
+        };
+        esp_modem_dte_config_t config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+        REQUIRE(vfs_create_socket(&socket_config, &config.vfs_config));
+        // nothing is left over from the UART config sharing the union
+        CHECK(config.vfs_config.reconnect == nullptr);
+        CHECK(config.vfs_config.set_baud_rate == nullptr);
+        CHECK(config.vfs_config.tx_queue_size == 0);
+        int no_delay = 0;
+        socklen_t len = sizeof(no_delay);
+        REQUIRE(getsockopt(config.vfs_config.fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, &len) == 0);
+        CHECK(no_delay != 0);
+        auto dte = create_vfs_dte(&config);
+        REQUIRE(dte != nullptr);
+        CHECK(dte->set_mode(modem_mode::COMMAND_MODE));
+        int peer = accept(listener, nullptr, nullptr);
+        REQUIRE(peer >= 0);
+        std::thread modem(answer_ok, peer);
+        CHECK(dte->command("AT\r", got_ok, 1000) == command_result::OK);
+        modem.join();
+        dte.reset();
+        close(peer);
+        close(listener);
+    }
+}
+
+TEST_CASE("Record and replay the terminal", "[esp_modem]")
+{
+    char path[] = "/tmp/esp_modem_record_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    int rssi = 0, ber = 0;
+    size_t log_size = 0;
+    {
+        auto term = std::make_unique<RecordingTerminal>(std::make_unique<LoopbackTerm>(), path, 64);  // grows on the way
+        auto recorder = term.get();
+        auto dte = std::make_shared<DTE>(std::move(term));
+        auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+        REQUIRE(dce != nullptr);
+        CHECK(dce->set_pin("1234") == command_result::OK);
+        CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
+        CHECK(rssi == 123);
+        log_size = recorder->log_size();
+    }
+    struct stat st = {};
+    REQUIRE(stat(path, &st) == 0);
+    CHECK(static_cast<size_t>(st.st_size) == log_size);     // trimmed to the records
+
+    auto term = std::make_unique<ReplayTerminal>(path);
+    auto replay = term.get();
+    CHECK(replay->read_bytes() == strlen("OK\r\n") + strlen("+CSQ: 123,456\n\r\nOK\r\n"));
+    auto dte = std::make_shared<DTE>(std::move(term));
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    REQUIRE(dce != nullptr);
+    replay->start();
+    rssi = 0;
+    CHECK(dce->set_pin("1234") == command_result::OK);
+    CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
+    CHECK(rssi == 123);
+    CHECK(ber == 456);
+    CHECK(replay->wait_until_done(1000));
+    dce.reset();
+    dte.reset();
+
+    // the data replayed before anybody reads are offered again after the last record
+    ReplayTerminal late(path, false, 0);
+    late.start();
+    CHECK(!late.wait_until_done(50));
+    size_t consumed = 0;
+    late.set_read_cb([&](uint8_t *, size_t len) {
+        uint8_t buf[64];
+        consumed += late.read(buf, std::min(len, sizeof(buf)));
+        return false;
+    });
+    CHECK(late.wait_until_done(1000));
+    late.stop();    // joins the replay thread, so the callback has finished
+    CHECK(consumed == late.read_bytes());
+    unlink(path);
+}
+
+TEST_CASE("Modem simulator over a pseudo terminal", "[esp_modem]")
+{
+    ModemSimulator modem;
+    REQUIRE(strlen(modem.device_name()) > 0);
+    struct esp_modem_vfs_uart_creator uart_config = {
+        .dev_name = modem.device_name(),
+        .uart = {
+            .port_num = UART_NUM_1,
+            .data_bits = UART_DATA_8_BITS,
+            .stop_bits = UART_STOP_BITS_1,
+            .parity = UART_PARITY_DISABLE,
+            .flow_control = ESP_MODEM_FLOW_CONTROL_NONE,
+            .baud_rate = 115200,
+        }
+    };
+    esp_modem_dte_config_t config = {};
+    config.dte_buffer_size = 512;
+    REQUIRE(vfs_create_uart(&uart_config, &config.vfs_config));
+    auto dte = create_vfs_dte(&config);
+    REQUIRE(dte != nullptr);
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG("APN");
+    esp_netif_t netif{};
+    auto dce = create_SIM7600_dce(&dce_config, dte, &netif);
+    REQUIRE(dce != nullptr);
+
+    int rssi = 0, ber = 0;
+    CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
+    CHECK(rssi == 20);
+    modem.set_response("AT+CSQ", "\r\n+CSQ: 31,0\r\n\r\nOK\r\n");
+
+    // commands and data travel in the multiplexer frames
+    CHECK(dce->set_mode(modem_mode::CMUX_MODE));
+    CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
+    CHECK(rssi == 31);
+    CHECK(dce_commands::set_data_mode(dte.get()) == command_result::OK);
+    CHECK(dte->set_mode(modem_mode::DATA_MODE));
+    std::vector<uint8_t> received;
+    std::mutex received_lock;
+    dte->set_read_cb([&](uint8_t *data, size_t len) {
+        std::lock_guard<std::mutex> l(received_lock);
+        received.insert(received.end(), data, data + len);
+        return false;
+    });
+    auto wait_for = [&](size_t len) {
+        for (int i = 0; i < 100; ++i) {
+            {
+                std::lock_guard<std::mutex> l(received_lock);
+                if (received.size() >= len) {
+                    return true;
+                }
+            }
+            usleep(10000);
+        }
+        return false;
+    };
+    uint8_t lcp_request[] = { 0x7e, 0xff, 0x7d, 0x23, 0xc0, 0x21, 0x7d, 0x21, 0x7d, 0x21, 0x7d, 0x20, 0x7d, 0x24, 0xd1, 0xb5, 0x7e };
+    const uint8_t lcp_ack[] = { 0x7e, 0xff, 0x7d, 0x23, 0xc0, 0x21, 0x7d, 0x22, 0x7d, 0x21, 0x7d, 0x20, 0x7d, 0x24, 0x7d, 0x3c, 0x90, 0x7e };
+    CHECK(dte->write(lcp_request, sizeof(lcp_request)) == sizeof(lcp_request));
+    REQUIRE(wait_for(sizeof(lcp_ack)));
+    {
+        std::lock_guard<std::mutex> l(received_lock);
+        CHECK(memcmp(received.data(), lcp_ack, sizeof(lcp_ack)) == 0);
+        received.clear();
+    }
+    uint8_t payload[] = "Loopback over DLCI 1";
+    CHECK(dte->write(payload, sizeof(payload)) == sizeof(payload));
+    REQUIRE(wait_for(sizeof(payload)));
+    {
+        std::lock_guard<std::mutex> l(received_lock);
+        CHECK(memcmp(received.data(), payload, sizeof(payload)) == 0);
+    }
+    // the other terminal keeps serving the commands
+    CHECK(dce->get_signal_quality(rssi, ber) == command_result::OK);
+    CHECK(modem.frame_errors() == 0);
+    dce.reset();
+    dte.reset();
+}